@@ -1,6 +1,9 @@
 from pyconcert import CPlexModel, CPlexException, \
-     CPlexInitError, CPlexNoSolution, concatenate
+     CPlexInitError, CPlexNoSolution, concatenate, SolveFuture, \
+     setThreadBudget, getThreadBudget
 
 from pyconcert import CPlexExpression as _CPlexExpression
 
+from scenarios import solve_scenarios
+
 
@@ -7,11 +7,15 @@
 
 #include <ilconcert/iloexpression.h>
 #include <ilconcert/iloenv.h>
+#include <vector>
+#include <set>
+#include <sstream>
 
 #include "debug.h"
 #include "optimizations.h"
 #include "simple_shared_ptr.h"
 #include "constants.h"
+#include "environment.hpp"
 
 using namespace std;
 
@@ -241,12 +245,12 @@ template<typename ParentType, typename T, int scalar_type> class ComponentBase {
 public:
     typedef T Value;
 
-  ComponentBase(IloEnv _env, const MetaData& md, bool preserve_striding)
+  ComponentBase(const ModelEnv& _env, const MetaData& md, bool preserve_striding)
     : _md(md, preserve_striding), env(_env)
   {
   }
 
-    inline IloEnv getEnv() const 
+    inline const ModelEnv& getEnv() const 
 	{
 	    return env;
 	}
@@ -415,61 +419,177 @@ protected:
 	}
 
     MetaData _md;
-    IloEnv env;
+    ModelEnv env;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// The concert arrays behind the containers.  These are shared through
+// SharedPointer; when the last reference goes away, the concert
+// objects are ended so the environment gets the memory back.  Any
+// variables in an expression or constraint array are left alone
+// unless this storage created them, and elements copied in from
+// another storage (see borrowFrom) are left to the storage they came
+// from, which is kept alive until this one goes.
+
+template <typename A> class PendingArrayEnd : public PendingEnd {
+public:
+    PendingArrayEnd(const A& _array)
+	: array(_array)
+	{
+	}
+
+    void end()
+	{
+	    try {
+		for(size_t i = 0; i < elements.size(); ++i)
+		    elements[i].end();
+
+		array.end();
+	    } catch(IloException&) {
+	    }
+	}
+
+    A array;
+    vector<IloExtractable> elements;
+};
+
+template <typename A> class ConcertStorage {
+public:
+    typedef SharedPointer<ConcertStorage<A> > Ptr;
+
+    ConcertStorage(const ModelEnv& env, long n)
+	: _env(env), _array(newArray(env, n)), _owns_variables(false)
+	{
+	}
+
+    ConcertStorage(const ModelEnv& env, const A& array, bool owns_variables = false)
+	: _env(env), _array(array), _owns_variables(owns_variables)
+	{
+	}
+
+    ~ConcertStorage()
+	{
+	    PendingArrayEnd<A> *p = new PendingArrayEnd<A>(_array);
+
+	    collectOwned(p->elements);
+
+	    _env.endLater(p);
+	}
+
+    inline A& array() { return _array; }
+
+    inline const A& array() const { return _array; }
+
+    void borrowFrom(const Ptr& parent)
+	{
+	    if(parent != this)
+		_parents.push_back(parent);
+	}
+
+private:
+    static A newArray(const ModelEnv& env, long n)
+	{
+	    EnvLock lock(env);
+	    return A(env.env(), n);
+	}
+
+    void collectOwned(vector<IloExtractable>& dest) const
+	{
+	    set<const void*> skip;
+
+	    for(size_t k = 0; k < _parents.size(); ++k)
+	    {
+		const A& pa = _parents[k]->array();
+
+		for(IloInt i = 0; i < pa.getSize(); ++i)
+		    skip.insert(pa[i].getImpl());
+	    }
+
+	    for(IloInt i = 0; i < _array.getSize(); ++i)
+	    {
+		const void* impl = _array[i].getImpl();
+
+		if(impl == NULL || (!_owns_variables && _array[i].isVariable()))
+		    continue;
+
+		if(!_parents.empty())
+		{
+		    if(skip.count(impl))
+			continue;
+		    skip.insert(impl);
+		}
+
+		dest.push_back(_array[i]);
+	    }
+	}
+
+    const ModelEnv _env;
+    A _array;
+    const bool _owns_variables;
+    vector<Ptr> _parents;
+};
+
+typedef ConcertStorage<IloExprArray> ExpressionStorage;
+typedef ConcertStorage<IloNumVarArray> VariableStorage;
+typedef ConcertStorage<IloConstraintArray> ConstraintStorage;
+
 class ExpressionArray : public ComponentBase<ExpressionArray, IloNumExpr, 0> {
 public:  
     typedef ComponentBase<ExpressionArray, IloNumExpr, 0> Base;
   
-    ExpressionArray(IloEnv env, const MetaData& md)
-      : Base(env, md, false), data_ptr(new IloExprArray(env, shape(0) * shape(1))),
-	  aux_var_ptr(NULL)
+    ExpressionArray(const ModelEnv& env, const MetaData& md)
+      : Base(env, md, false), 
+	data_ptr(new ExpressionStorage(env, shape(0) * shape(1))),
+	aux_var_ptr(NULL)
 	{
 	}
 
-    ExpressionArray(IloEnv env, IloNumVarArray * v, const MetaData& md)
-      : Base(env, md, false), data_ptr(new IloExprArray(env, shape(0) * shape(1))),
-	  aux_var_ptr(v)
+    ExpressionArray(const ModelEnv& env, const IloNumVarArray& v, const MetaData& md)
+      : Base(env, md, false), 
+	data_ptr(new ExpressionStorage(env, shape(0) * shape(1))),
+	aux_var_ptr(new VariableStorage(env, v, true))
 	{
-	    assert_equal(v->getSize(), shape(0)*shape(1));
+	    assert_equal(v.getSize(), shape(0)*shape(1));
 
 	    for(long i = 0; i < shape(0) * shape(1); ++i)
-		(*data_ptr)[i] = (*v)[i];
+		exprs()[i] = v[i];
 	}
     
     ExpressionArray(const ExpressionArray& ea, const MetaData& md)
-      : Base(ea.env, md, true), data_ptr(ea.data_ptr), aux_var_ptr(NULL)
+      : Base(ea.env, md, true), data_ptr(ea.data_ptr), aux_var_ptr(ea.aux_var_ptr)
 	{
 	}
 
     template<typename Slice0, typename Slice1>
     ExpressionArray(const ExpressionArray& ea, const Slice0& s0, const Slice1& s1)
       : Base(ea.env, MetaData(ea.md(), s0, s1), true), data_ptr(ea.data_ptr),
-	  aux_var_ptr(NULL)
+	  aux_var_ptr(ea.aux_var_ptr)
 	{
 	}
 
 private:
-    SharedPointer<IloExprArray> data_ptr;
+    SharedPointer<ExpressionStorage> data_ptr;
 
-    // This allows us to work with an auxilary variable 
-    SharedPointer<IloNumVarArray> aux_var_ptr;
+    // This allows us to work with an auxilary variable; views of a
+    // variable block share it, and index it like the expressions.
+    SharedPointer<VariableStorage> aux_var_ptr;
+
+    inline IloExprArray& exprs() const { return data_ptr->array(); }
 
 public:
 
     inline Value& operator()(long i, long j)
 	{ 
 	    long idx = getIndex(i,j);
-	    assert_lt(idx,data_ptr->getSize());
-	    return (*data_ptr)[idx];
+	    assert_lt(idx,exprs().getSize());
+	    return exprs()[idx];
 	}
 
     inline const Value& operator()(long i, long j) const
 	{ 
 	    long idx = getIndex(i,j);
-	    assert_lt(idx,data_ptr->getSize());
-	    return (*data_ptr)[idx];
+	    assert_lt(idx,exprs().getSize());
+	    return exprs()[idx];
 	}
 
     inline void set(long i, long j, const Value& v) 
@@ -490,7 +610,14 @@ public:
     ////////////////////////////////////////////////////////////////////////////////
     // Methods specific to this case
 
-    inline const IloExprArray& expression() const { return *data_ptr; }
+    inline const IloExprArray& expression() const { return exprs(); }
+
+    // Marks the elements copied over from src as belonging to src,
+    // which is then kept alive for as long as this array is.
+    inline void borrowFrom(const ExpressionArray& src)
+	{
+	    data_ptr->borrowFrom(src.data_ptr);
+	}
 
     inline bool hasVar() const { return aux_var_ptr != NULL; }
 
@@ -498,12 +625,12 @@ public:
 	{
 	    assert(hasVar());
 
-	    return (*aux_var_ptr);
+	    return aux_var_ptr->array();
 	}
 
     inline bool isComplete() const
 	{
-	    return md().offset() == 0 && data_ptr->getSize() == size();
+	    return md().offset() == 0 && exprs().getSize() == size();
 	}
 };
 
@@ -512,24 +639,25 @@ public:
     typedef IloConstraint Value;
     typedef ComponentBase<ConstraintArray, IloConstraint, 0> Base;
 
-    ConstraintArray(IloEnv env, const MetaData& _md)
-      : Base(env, _md, false), data_ptr(new IloConstraintArray(env, shape(0)*shape(1)) )
+    ConstraintArray(const ModelEnv& env, const MetaData& _md)
+      : Base(env, _md, false), 
+	data_ptr(new ConstraintStorage(env, shape(0)*shape(1)))
 	{
 	}
     
 private:
-    SharedPointer<IloConstraintArray> data_ptr;
+    SharedPointer<ConstraintStorage> data_ptr;
 
 public:
 
     inline Value& operator()(long i, long j) 
 	{ 
-	    return (*data_ptr)[getIndex(i,j)];
+	    return data_ptr->array()[getIndex(i,j)];
 	}
 
     inline const Value& operator()(long i, long j) const
 	{ 
-	    return (*data_ptr)[getIndex(i,j)];
+	    return data_ptr->array()[getIndex(i,j)];
 	}
 
     inline void set(long i, long j, const Value& v) 
@@ -537,10 +665,73 @@ public:
 	    (*this)(i,j) = v;
 	}
 
-    inline const IloConstraintArray& constraint() const { return *data_ptr; }
+    inline const IloConstraintArray& constraint() const { return data_ptr->array(); }
 
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Creates a new block of variables with the given bounds, named as
+// described in CPlexModel.new.  Holds the environment lock, so it may
+// be called without the GIL.
+
+#define VAR_NAME_SCALAR 0
+#define VAR_NAME_ARRAY  1
+#define VAR_NAME_MATRIX 2
+
+inline ExpressionArray* newVariableExpression(
+    const ModelEnv& env, const double* lb, const double* ub, 
+    long shape_0, long shape_1, IloNumVar::Type var_type,
+    const char* name, int name_mode)
+{
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_BUILD);
+
+    const long n = shape_0 * shape_1;
+
+    countStat(env.stats().expressions_created, 1);
+
+    IloNumArray lb_a(env.env(), n);
+    IloNumArray ub_a(env.env(), n);
+
+    for(long i = 0; i < n; ++i)
+    {
+	lb_a[i] = lb[i];
+	ub_a[i] = ub[i];
+    }
+
+    IloNumVarArray v(env.env(), lb_a, ub_a, var_type);
+
+    lb_a.end();
+    ub_a.end();
+
+    if(name != NULL)
+    {
+	for(long i = 0; i < shape_0; ++i)
+	{
+	    for(long j = 0; j < shape_1; ++j)
+	    {
+		ostringstream var_name;
+
+		switch(name_mode) {
+		case VAR_NAME_SCALAR:
+		    var_name << name;
+		    break;
+		case VAR_NAME_ARRAY:
+		    var_name << name << "[" << (i*shape_1 + j) << "]";
+		    break;
+		default:
+		    var_name << name << "[" << i << "," << j << "]";
+		    break;
+		}
+
+		v[i*shape_1 + j].setName(var_name.str().c_str());
+	    }
+	}
+    }
+
+    return new ExpressionArray(env, v, MetaData(MATRIX_MODE, shape_0, shape_1));
+}
+
 // These come from other operations
 
 class NumericalArray : public ComponentBase<NumericalArray, double, 0> {
@@ -549,7 +740,7 @@ public:
     typedef ComponentBase<NumericalArray, double, 0> Base;
     typedef Base::Value Value;
 
-    NumericalArray(IloEnv env, double* _data, const MetaData& _md)
+    NumericalArray(const ModelEnv& env, double* _data, const MetaData& _md)
       : Base(env, _md, true), data(_data)
 	{
 	}
@@ -579,12 +770,12 @@ public:
     typedef ComponentBase<Scalar, double, 1> Base;
     typedef double Value;
 
-    Scalar(IloEnv env, const double& _value)
+    Scalar(const ModelEnv& env, const double& _value)
       : Base(env, MetaData(ARRAY_MODE, 1, 1, 0, 0), true), value(_value)
 	{
 	}
 
-    Scalar(IloEnv env, const double& _value, const MetaData&)
+    Scalar(const ModelEnv& env, const double& _value, const MetaData&)
       : Base(env, MetaData(ARRAY_MODE, 1, 1, 0, 0), true), value(_value)
 	{
 	}
@@ -11,18 +11,122 @@
 #include <ilconcert/ilomodel.h>
 #include <ilcplex/ilocplexi.h>
 #include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <vector>
 
 #include "debug.h"
 #include "optimizations.h"
 #include "simple_shared_ptr.h"
 #include "containers.hpp"
 #include "operators.hpp"
+#include "parameters.hpp"
+#include "progress.hpp"
+#include "separator.hpp"
+#include "thread_budget.hpp"
 
 using namespace std;
 
 #define MODEL_UNBOUNDED 2
 #define MODEL_INFEASABLE 3
 #define MODEL_UNBOUNDED_OR_INFEASABLE 4
+#define MODEL_ABORTED 5
+#define MODEL_LIMIT_REACHED 6
+
+// The outcome of the last solve, in SolveInfo
+#define SOLVE_NONE                       0
+#define SOLVE_OPTIMAL                    1
+#define SOLVE_FEASIBLE                   2
+#define SOLVE_LIMIT_REACHED              3
+#define SOLVE_INFEASIBLE                 4
+#define SOLVE_UNBOUNDED                  5
+#define SOLVE_INFEASIBLE_OR_UNBOUNDED    6
+#define SOLVE_ABORTED                    7
+#define SOLVE_ERROR                      8
+
+// What the last solve ended with.  A solve stopped by a time or other
+// limit with an incumbent is SOLVE_FEASIBLE, and the incumbent's
+// values are available as after any other solve.
+struct SolveInfo {
+  int outcome;
+  int cplex_status;
+  double objective;
+  double best_bound;
+  double gap;
+  long nodes;
+
+  // Set when a thread budget is in use; see thread_budget.hpp
+  long threads;
+  double queue_wait;
+};
+
+// Where addConstraint puts a constraint block
+#define CONSTRAINT_MODEL     0
+#define CONSTRAINT_LAZY      1
+#define CONSTRAINT_USER_CUT  2
+
+////////////////////////////////////////////////////////////////////////////////
+// Lets another thread stop a solve.  The abort request sticks to this
+// object rather than to the model, so a request arriving before the
+// solve starts stops it immediately, and one arriving after it
+// finishes has no effect on later solves.  abort() never takes the
+// environment lock, which the solve is holding.
+
+class SolveAborter {
+public:
+  SolveAborter()
+    : requested(false), active(NULL)
+  {
+    pthread_mutex_init(&lock, NULL);
+  }
+
+  ~SolveAborter()
+  {
+    pthread_mutex_destroy(&lock);
+  }
+
+  void abort()
+  {
+    pthread_mutex_lock(&lock);
+    requested = true;
+    if(active != NULL)
+      active->abort();
+    pthread_mutex_unlock(&lock);
+  }
+
+  bool abortRequested() const
+  {
+    return requested;
+  }
+
+private:
+  friend class CPlexModelInterface;
+
+  // Returns false if the solve should not start at all.
+  bool attach(IloCplex::Aborter* aborter)
+  {
+    pthread_mutex_lock(&lock);
+    active = requested ? NULL : aborter;
+    pthread_mutex_unlock(&lock);
+
+    return active != NULL;
+  }
+
+  void detach()
+  {
+    pthread_mutex_lock(&lock);
+    active = NULL;
+    pthread_mutex_unlock(&lock);
+  }
+
+  pthread_mutex_t lock;
+  volatile bool requested;
+  IloCplex::Aborter* active;
+};
 
 ////////////////////////////////////////////////////////////////////////////////
 // Now the same for the model
@@ -44,42 +148,138 @@ public:
     const char* message;
   };
   
-  CPlexModelInterface(IloEnv _env) 
-    : env(_env), model(_env), solver(_env), current_objective(NULL), model_extracted(false), model_solved(false)
+  CPlexModelInterface(const ModelEnv& _env) 
+    : env(_env), model(_env.env()), solver(_env.env()), aborter(_env.env()), 
+      mip_start_vars(_env.env()), mip_start_values(_env.env()), current_objective(NULL), objective_owned(false), model_extracted(false), model_solved(false),
+      value_cache_valid(false), imported_maximize(false),
+      separate_function(NULL), separate_handler(NULL)
+  {
+    clearSolveInfo();
+    pthread_mutex_init(&progress_lock, NULL);
+    pthread_mutex_init(&separate_lock, NULL);
+    solver.use(aborter);
+    env.addModel();
+  }
+
+  ~CPlexModelInterface()
   {
+    // The variable and constraint blocks held below are released
+    // after this, ending whatever is no longer referenced elsewhere.
+    env.endLater(new PendingModelEnd(model, solver, aborter, 
+				       mip_start_vars, mip_start_values, current_objective));
+
+    pthread_mutex_destroy(&separate_lock);
+    pthread_mutex_destroy(&progress_lock);
+    env.removeModel();
   }
 
   Status addVariables(const ExpressionArray& expr)
   {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_CONSTRAIN);
+
     try{
       model.add(expr.variables());
     } catch(IloException& e) {
       return Status(e.getMessage());
     }
 
+    variable_blocks.push_back(expr);
+
     return Status();
   }
 
-  Status addConstraint(const ConstraintArray& cstr)
+  // Adds a constraint block to the model, or, with CONSTRAINT_LAZY or
+  // CONSTRAINT_USER_CUT, to the solver's lazy constraint or user cut
+  // pool.  Pooled constraints are not part of the extracted model;
+  // CPlex only checks them against candidate solutions (lazy) or uses
+  // them to tighten the relaxation (cuts) during a MIP solve.
+  Status addConstraint(const ConstraintArray& cstr, int pool = CONSTRAINT_MODEL)
+  {
+    return addConstraints(vector<const ConstraintArray*>(1, &cstr), pool);
+  }
+
+  // Adds many constraint blocks at once, as one array, so that CPlex
+  // takes all the rows in one go.
+  Status addConstraints(const vector<const ConstraintArray*>& blocks, int pool = CONSTRAINT_MODEL)
   {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_CONSTRAIN);
+
+    list<ConstraintArray>* dest;
+
+    switch(pool) {
+    case CONSTRAINT_MODEL:     dest = &constraint_blocks; break;
+    case CONSTRAINT_LAZY:      dest = &lazy_blocks;       break;
+    case CONSTRAINT_USER_CUT:  dest = &user_cut_blocks;   break;
+    default:
+      return Status("Unknown constraint pool.");
+    }
+
     model_solved = false;
 
+    IloConstraintArray all(env.env());
+    long n = 0;
+
     try{
-      model.add(cstr.constraint());
+      for(size_t i = 0; i < blocks.size(); ++i) {
+	all.add(blocks[i]->constraint());
+	n += blocks[i]->size();
+      }
+
+      // Pooled constraints are otherwise added on extraction, which
+      // clears the pools
+      if(pool == CONSTRAINT_MODEL)
+	model.add(all);
+      else if(pool == CONSTRAINT_LAZY && model_extracted)
+	solver.addLazyConstraints(all);
+      else if(pool == CONSTRAINT_USER_CUT && model_extracted)
+	solver.addUserCuts(all);
     } catch(IloException& e) {
+      all.end();
       return Status(e.getMessage());
     }
 
+    all.end();
+
+    for(size_t i = 0; i < blocks.size(); ++i)
+      dest->push_back(*blocks[i]);
+
+    countStat(env.stats().constraints_added, n);
+
     return Status();
   }
 
   Status setObjective(const ExpressionArray& expr, bool maximize)
   {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_CONSTRAIN);
+
     model_solved = false;
+
+    if(expr.shape(0) != 1 || expr.shape(1) != 1)
+      return Status("Objective must be a scalar (or 1x1 matrix) expression.");
+
+    // The same objective as before is kept, along with any changes
+    // made by setObjectiveCoefs, so it needn't be extracted again.
+    if(current_objective != NULL && objective_source != NULL
+       && (*objective_source)(0,0).getImpl() == expr(0,0).getImpl()) {
+      try {
+	IloObjective::Sense sense = maximize ? IloObjective::Maximize : IloObjective::Minimize;
+
+	if(current_objective->getSense() != sense)
+	  current_objective->setSense(sense);
+      } catch(IloException& e) {
+	return Status(e.getMessage());
+      }
+
+      return Status();
+    }
 	    
     try {
       if(current_objective != NULL) {
 	model.remove(*current_objective);
+	current_objective->end();
 	delete current_objective;
 	current_objective = NULL;
       }
@@ -87,15 +287,14 @@ public:
       return Status(e.getMessage());
     }
 
-    if(expr.shape(0) != 1 || expr.shape(1) != 1)
-      return Status("Objective must be a scalar (or 1x1 matrix) expression.");
+    objective_owned = false;
 
     try {
 		
       if(maximize)
-	current_objective = new IloObjective(IloMaximize(env, expr(0,0)));
+	current_objective = new IloObjective(IloMaximize(env.env(), expr(0,0)));
       else
-	current_objective = new IloObjective(IloMinimize(env, expr(0,0)));
+	current_objective = new IloObjective(IloMinimize(env.env(), expr(0,0)));
 		
       model.add(*current_objective);
     }
@@ -103,24 +302,237 @@ public:
       return Status(e.getMessage());
     }
 
+    objective_source = SharedPointer<ExpressionArray>(new ExpressionArray(expr));
+
     return Status();
   }
+
+  // Sets the coefficients of the variables in expr in the current
+  // objective, in one call into CPlex.  The objective keeps them
+  // while solve is called with the same objective expression.
+  Status setObjectiveCoefs(const ExpressionArray& expr, const NumericalArray& coefs)
+  {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_CONSTRAIN);
+
+    assert_equal(coefs.shape(0), expr.shape(0));
+    assert_equal(coefs.shape(1), expr.shape(1));
+
+    if(current_objective == NULL)
+      return Status("Model has no objective yet.");
+
+    if(!expr.hasVar())
+      return Status("Objective coefficients can only be set for variables, not expressions.");
+
+    const long n = expr.shape(0) * expr.shape(1);
+
+    IloNumVarArray vars(env.env(), n);
+    IloNumArray values(env.env(), n);
+
+    Status status;
+
+    try {
+      ownObjective();
+
+      const IloNumVarArray& block = expr.variables();
+
+      for(long i = 0; i < expr.shape(0); ++i) {
+	for(long j = 0; j < expr.shape(1); ++j) {
+	  vars[i*expr.shape(1) + j] = block[expr.getIndex(i,j)];
+	  values[i*expr.shape(1) + j] = coefs(i,j);
+	}
+      }
+
+      current_objective->setLinearCoefs(vars, values);
+      model_solved = false;
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    vars.end();
+    values.end();
+
+    return status;
+  }
     
   Status removeConstraint(const ConstraintArray& csr)
   {
+    return removeConstraints(vector<const ConstraintArray*>(1, &csr));
+  }
+
+  // Removes all the blocks, whichever pool they are in, with one call
+  // per pool.  Either all of them are removed or, if CPlex refuses
+  // one, none.
+  Status removeConstraints(const vector<const ConstraintArray*>& blocks)
+  {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_CONSTRAIN);
+
     model_solved = false;
 
+    IloConstraintArray lazy(env.env());
+    IloConstraintArray cuts(env.env());
+    IloConstraintArray all(env.env());
+
+    Status status;
+
     try {
-      model.remove(csr.constraint());
+      for(size_t k = 0; k < blocks.size(); ++k) {
+	const ConstraintArray& csr = *blocks[k];
+
+	if(inPool(lazy_blocks, csr))
+	  lazy.add(csr.constraint());
+	else if(inPool(user_cut_blocks, csr))
+	  cuts.add(csr.constraint());
+	else
+	  all.add(csr.constraint());
+      }
+
+      // Pooled constraints are only in the solver once extracted
+      int done = 0;
+
+      try {
+	if(model_extracted) {
+	  solver.removeLazyConstraints(lazy);
+	  ++done;
+	  solver.removeUserCuts(cuts);
+	  ++done;
+	}
+
+	model.remove(all);
+      } catch(IloException&) {
+	// Puts back what was already taken out
+	if(done > 0)
+	  solver.addLazyConstraints(lazy);
+	if(done > 1)
+	  solver.addUserCuts(cuts);
+	throw;
+      }
     } catch(IloException& e) {
-      return Status(e.getMessage());
+      status = Status(e.getMessage());
     }
 
-    return Status();
+    lazy.end();
+    cuts.end();
+    all.end();
+
+    if(status.error_code != 0)
+      return status;
+
+    for(size_t k = 0; k < blocks.size(); ++k) {
+      if(!removeFromPool(lazy_blocks, *blocks[k])
+	 && !removeFromPool(user_cut_blocks, *blocks[k]))
+	removeFromPool(constraint_blocks, *blocks[k]);
+    }
+
+    return status;
+  }
+
+  long numLazyConstraints() const
+  {
+    return poolSize(lazy_blocks);
+  }
+
+  long numUserCuts() const
+  {
+    return poolSize(user_cut_blocks);
+  }
+
+  // Sets the constant side of each constraint in cstr from rhs, in
+  // one call into CPlex: the upper bound of <= constraints, the lower
+  // bound of >= constraints and both for equalities.  CPlex starts the
+  // next solve from the current basis.
+  Status updateRHS(const ConstraintArray& cstr, const NumericalArray& rhs)
+  {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_CONSTRAIN);
+
+    if(sharedWithClones())
+      return Status("Right hand sides cannot be changed in place while the model has clones.");
+
+    assert_equal(rhs.shape(0), cstr.shape(0));
+    assert_equal(rhs.shape(1), cstr.shape(1));
+
+    IloRangeArray ranges(env.env());
+    IloNumArray lbs(env.env());
+    IloNumArray ubs(env.env());
+
+    Status status;
+
+    try {
+      status = collectRHSRanges(cstr, ranges, lbs, ubs);
+
+      if(status.error_code == 0) {
+	for(long i = 0; i < cstr.shape(0); ++i)
+	  for(long j = 0; j < cstr.shape(1); ++j)
+	    setRHS(lbs[i*cstr.shape(1) + j], ubs[i*cstr.shape(1) + j], rhs(i,j));
+
+	ranges.setBounds(lbs, ubs);
+	model_solved = false;
+      }
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    ranges.end();
+    lbs.end();
+    ubs.end();
+
+    return status;
+  }
+
+  // Sets the bounds of the variables in expr in one call into CPlex.
+  // Either lb or ub may be NULL to leave those bounds as they are.
+  Status updateBounds(const ExpressionArray& expr, const NumericalArray* lb, const NumericalArray* ub)
+  {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_CONSTRAIN);
+
+    if(sharedWithClones())
+      return Status("Bounds cannot be changed in place while the model has clones.");
+
+    if(!expr.hasVar())
+      return Status("Bounds can only be set on variables, not expressions.");
+
+    const long n = expr.shape(0) * expr.shape(1);
+
+    IloNumVarArray vars(env.env(), n);
+    IloNumArray lbs(env.env(), n);
+    IloNumArray ubs(env.env(), n);
+
+    Status status;
+
+    try {
+      const IloNumVarArray& block = expr.variables();
+
+      for(long i = 0; i < expr.shape(0); ++i) {
+	for(long j = 0; j < expr.shape(1); ++j) {
+	  const long k = i*expr.shape(1) + j;
+	  IloNumVar v = block[expr.getIndex(i,j)];
+
+	  vars[k] = v;
+	  lbs[k] = (lb != NULL) ? (*lb)(i,j) : v.getLB();
+	  ubs[k] = (ub != NULL) ? (*ub)(i,j) : v.getUB();
+	}
+      }
+
+      vars.setBounds(lbs, ubs);
+      model_solved = false;
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    vars.end();
+    lbs.end();
+    ubs.end();
+
+    return status;
   }
 
   Status setStartingValues(const ExpressionArray& expr, const NumericalArray& numr)
   {
+    EnvLock lock(env);
+
     try {
       if(!model_extracted)
 	extractModel();
@@ -128,7 +540,7 @@ public:
       if(!expr.hasVar())
 	return Status("Only variables may be set, not expressions.");
 
-      IloNumArray X(env, expr.size());
+      IloNumArray X(env.env(), expr.size());
 
       if(expr.isComplete()) 
 	{
@@ -140,7 +552,7 @@ public:
 	} 
       else
 	{
-	  IloNumVarArray xpr(env, expr.size());
+	  IloNumVarArray xpr(env.env(), expr.size());
 
 	  for(long i = 0; i < expr.shape(0); ++i) {
 	    for(long j = 0; j < expr.shape(1); ++j)
@@ -161,159 +573,1708 @@ public:
     return Status();
   }
     
-  template <typename Param, typename V>
-  Status setParameter(const Param& p, V value)
+  // Sets the values of the last solve, taken from the snapshot, as
+  // the starting point of the next one.
+  Status recycleSolution()
   {
-    try{
-      solver.setParam(p, value);
-    } catch(IloException& e){
+    EnvLock lock(env);
+
+    if(!value_cache_valid)
+      return Status("No previous solution to recycle.");
+
+    IloNumVarArray vars(env.env());
+    IloNumArray values(env.env(), value_cache.size());
+
+    Status status;
+
+    try {
+      if(!model_extracted)
+	extractModel();
+
+      // Blocks added since the snapshot come last and are left out
+      for(list<ExpressionArray>::const_iterator it = variable_blocks.begin();
+	  it != variable_blocks.end(); ++it) {
+	if(value_offsets.find(it->variables().getImpl()) != value_offsets.end())
+	  vars.add(it->variables());
+      }
+
+      for(long i = 0; i < values.getSize(); ++i)
+	values[i] = value_cache[i];
+
+      solver.getImpl()->setVectors(values, 0, vars, 0, 0, 0);
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    vars.end();
+    values.end();
+
+    return status;
+  }
+
+  // A MIP start is built up from any number of variable blocks with
+  // addMIPStartValues, then handed to CPlex in one call by
+  // commitMIPStart.  The arrays are reused between starts.
+  Status addMIPStartValues(const ExpressionArray& expr, const NumericalArray& numr)
+  {
+    EnvLock lock(env);
+
+    if(!expr.hasVar())
+      return Status("Only variables may be set, not expressions.");
+
+    try {
+      const IloNumVarArray& vars = expr.variables();
+
+      for(long i = 0; i < expr.shape(0); ++i) {
+	for(long j = 0; j < expr.shape(1); ++j) {
+	  mip_start_vars.add(vars[expr.getIndex(i,j)]);
+	  mip_start_values.add(numr(i,j));
+	}
+      }
+    } catch(IloException& e) {
       return Status(e.getMessage());
     }
 
     return Status();
   }
 
-  Status solve(IloNum * elapsed_time = NULL)
+  Status commitMIPStart(int effort)
   {
+    EnvLock lock(env);
 
-    try{
+    Status status;
+
+    try {
       if(!model_extracted)
 	extractModel();
-    
-      if(elapsed_time != NULL)
-	*elapsed_time = -solver.getImpl()->getCplexTime();
 
-      if(! solver.solve() )
-	{
-	  *elapsed_time = 0;
+      if(mip_start_vars.getSize() != 0)
+	solver.addMIPStart(mip_start_vars, mip_start_values, IloCplex::MIPStartEffort(effort));
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
 
-	  IloAlgorithm::Status status = solver.getStatus();
-		    
-	  switch(status) {
-	  case IloAlgorithm::Unbounded:
-	    return Status("Model unbounded.", MODEL_UNBOUNDED);
-	  case IloAlgorithm::Infeasible:
-	    return Status("Model infeasible.", MODEL_INFEASABLE);
-	  case IloAlgorithm::InfeasibleOrUnbounded:
-	    return Status("Model unbounded or infeasable.", MODEL_UNBOUNDED_OR_INFEASABLE);
-	  default:
-	    return Status("Unknown error occured while solving model.");
-	  }
-	}
+    discardMIPStart();
 
-      if(elapsed_time != NULL)
-	*elapsed_time += solver.getImpl()->getCplexTime();
-    }
-    catch(IloException& e){
+    return status;
+  }
+
+  void discardMIPStart()
+  {
+    EnvLock lock(env);
+
+    mip_start_vars.clear();
+    mip_start_values.clear();
+  }
+
+  Status clearMIPStarts()
+  {
+    EnvLock lock(env);
+
+    try {
+      if(model_extracted && solver.getNMIPStarts() != 0)
+	solver.deleteMIPStarts(0, solver.getNMIPStarts());
+    } catch(IloException& e) {
       return Status(e.getMessage());
     }
-	    
-    model_solved = true;
 
     return Status();
   }
 
-  Status readBasis(const char* filename)
+  template <typename Param, typename V>
+  Status setParameter(const Param& p, V value)
   {
+    EnvLock lock(env);
+
     try{
-      solver.readBasis(filename);
-    }
-    catch(IloException& e){
+      solver.setParam(p, value);
+    } catch(IloException& e){
       return Status(e.getMessage());
     }
+
     return Status();
   }
 
-  Status writeBasis(const char* filename)
+  // Parameters by name, as listed in parameters.hpp.  Integer, long
+  // and boolean parameters are passed as doubles.
+  Status setNamedParameter(const char* name, double value)
   {
-    try{
-      solver.writeBasis(filename);
-    }
-    catch(IloException& e){
-      return Status(e.getMessage());
+    const ParameterEntry* p = findParameter(name);
+
+    if(p == NULL)
+      return Status("Unknown parameter.");
+
+    switch(p->kind) {
+    case PARAM_INT:
+      return setParameter(IloCplex::IntParam(p->id), IloInt(value));
+    case PARAM_LONG:
+      return setParameter(IloCplex::LongParam(p->id), IloInt(value));
+    case PARAM_NUM:
+      return setParameter(IloCplex::NumParam(p->id), IloNum(value));
+    case PARAM_BOOL:
+      return setParameter(IloCplex::BoolParam(p->id), IloBool(value != 0));
+    default:
+      return Status("Parameter does not take a number.");
     }
-    return Status();
   }
 
-  double getObjectiveValue()
+  Status setStringParameter(const char* name, const char* value)
   {
-    if(!model_solved)
-      return 0;
-	    
-    return solver.getObjValue();
+    const ParameterEntry* p = findParameter(name);
+
+    if(p == NULL)
+      return Status("Unknown parameter.");
+
+    if(p->kind != PARAM_STRING)
+      return Status("Parameter does not take a string.");
+
+    return setParameter(IloCplex::StringParam(p->id), value);
   }
 
-  Status getValues(NumericalArray& dest, const ExpressionArray& expr)
+  Status getNamedParameter(const char* name, double* value)
   {
-    assert_equal(dest.shape(0), expr.shape(0));
-    assert_equal(dest.shape(1), expr.shape(1));
-	    
-    // if(!model_solved)
-    // 	return Status("Cannot get value; model not in a solved state.");
-		    
-    try{
-      for(long i = 0; i < dest.shape(0); ++i)
-	for(long j = 0; j < dest.shape(1); ++j)
-	  dest(i,j) = solver.getValue(expr(i,j));
-    }
-    catch(IloException& e){
+    EnvLock lock(env);
+
+    const ParameterEntry* p = findParameter(name);
+
+    if(p == NULL)
+      return Status("Unknown parameter.");
+
+    try {
+      switch(p->kind) {
+      case PARAM_INT:
+	*value = solver.getParam(IloCplex::IntParam(p->id));
+	break;
+      case PARAM_LONG:
+	*value = solver.getParam(IloCplex::LongParam(p->id));
+	break;
+      case PARAM_NUM:
+	*value = solver.getParam(IloCplex::NumParam(p->id));
+	break;
+      case PARAM_BOOL:
+	*value = solver.getParam(IloCplex::BoolParam(p->id)) ? 1 : 0;
+	break;
+      default:
+	return Status("Parameter is not a number.");
+      }
+    } catch(IloException& e) {
       return Status(e.getMessage());
     }
-	    
+
     return Status();
   }
 
-  long getNIterations() const
+  Status getStringParameter(const char* name, string* value)
   {
-    if(solved())
+    EnvLock lock(env);
+
+    const ParameterEntry* p = findParameter(name);
+
+    if(p == NULL)
+      return Status("Unknown parameter.");
+
+    if(p->kind != PARAM_STRING)
+      return Status("Parameter is not a string.");
+
+    try {
+      *value = solver.getParam(IloCplex::StringParam(p->id));
+    } catch(IloException& e) {
+      return Status(e.getMessage());
+    }
+
+    return Status();
+  }
+
+  // Parameter sets in CPlex's .prm format
+  Status readParameters(const char* filename)
+  {
+    EnvLock lock(env);
+
+    try {
+      solver.readParam(filename);
+    } catch(IloException& e) {
+      return Status(e.getMessage());
+    }
+
+    return Status();
+  }
+
+  Status writeParameters(const char* filename)
+  {
+    EnvLock lock(env);
+
+    try {
+      solver.writeParam(filename);
+    } catch(IloException& e) {
+      return Status(e.getMessage());
+    }
+
+    return Status();
+  }
+
+  Status setDefaultParameters()
+  {
+    EnvLock lock(env);
+
+    try {
+      solver.setDefaults();
+    } catch(IloException& e) {
+      return Status(e.getMessage());
+    }
+
+    return Status();
+  }
+
+  Status solve(IloNum * elapsed_time = NULL, SolveAborter* control = NULL)
+  {
+    EnvLock lock(env);
+
+    return solveWithCallbacks(elapsed_time, control, false);
+  }
+
+  // Calls function with the values of the variables given by
+  // addSeparatedVariables(), concatenated in row major order, at each
+  // candidate solution of a MIP solve; see separator.hpp.  handler is
+  // passed back as is.  A NULL function removes the separator.
+  void setLazySeparator(SeparateFunction function, void* handler)
+  {
+    EnvLock lock(env);
+
+    separate_blocks.clear();
+    separate_function = function;
+    separate_handler = handler;
+    model_solved = false;
+  }
+
+  Status addSeparatedVariables(const ExpressionArray& expr)
+  {
+    EnvLock lock(env);
+
+    if(!expr.hasVar())
+      return Status("Separation only works on variable blocks.");
+
+    separate_blocks.push_back(expr);
+
+    return Status();
+  }
+
+  // Solves the model once for each of n scenarios, changing the model
+  // in place in between, so each solve starts from the last one.  For
+  // scenario k, row k of costs (if not NULL) gives the objective
+  // coefficients of the variables in cost_vars, and row k of rhs (if
+  // not NULL) the right hand sides of cstr, as in setObjectiveCoefs
+  // and updateRHS.  The objective value goes to objective_values[k]
+  // and the values of the variables in value_vars (if not NULL) to
+  // row k of values; scenarios that are infeasible or unbounded give
+  // NaN for all of them.  The changes of the last scenario remain.
+  Status solveBatch(long n,
+		    const ExpressionArray* cost_vars, const double* costs,
+		    const ConstraintArray* cstr, const double* rhs,
+		    const ExpressionArray* value_vars,
+		    double* objective_values, double* values)
+  {
+    EnvLock lock(env);
+
+    if(current_objective == NULL)
+      return Status("Model has no objective.");
+
+    if(cost_vars != NULL && !cost_vars->hasVar())
+      return Status("Objective coefficients can only be set for variables, not expressions.");
+
+    if(value_vars != NULL && !value_vars->hasVar())
+      return Status("Values can only be returned for variables, not expressions.");
+
+    if(rhs != NULL && sharedWithClones())
+      return Status("Right hand sides cannot be changed in place while the model has clones.");
+
+    IloNumVarArray c_vars(env.env());
+    IloNumArray c_values(env.env());
+    IloRangeArray ranges(env.env());
+    IloNumArray lbs(env.env());
+    IloNumArray ubs(env.env());
+    IloNumVarArray v_vars(env.env());
+    IloNumArray v_values(env.env());
+
+    Status status;
+
+    try {
+      if(cost_vars != NULL) {
+	collectVariables(c_vars, *cost_vars);
+	c_values.add(c_vars.getSize(), 0);
+	ownObjective();
+      }
+
+      if(cstr != NULL)
+	status = collectRHSRanges(*cstr, ranges, lbs, ubs);
+
+      if(value_vars != NULL)
+	collectVariables(v_vars, *value_vars);
+
+      const long n_c = c_vars.getSize(), n_r = ranges.getSize(), n_v = v_vars.getSize();
+
+      for(long k = 0; k < n && status.error_code == 0; ++k) {
+	if(costs != NULL) {
+	  for(long i = 0; i < n_c; ++i)
+	    c_values[i] = costs[k*n_c + i];
+
+	  current_objective->setLinearCoefs(c_vars, c_values);
+	}
+
+	if(rhs != NULL) {
+	  for(long i = 0; i < n_r; ++i)
+	    setRHS(lbs[i], ubs[i], rhs[k*n_r + i]);
+
+	  ranges.setBounds(lbs, ubs);
+	}
+
+	// Only the last solve leaves its values for getValues, and
+	// only if it found a solution.  Each one runs the callbacks, so
+	// lazy constraints hold in every scenario.
+	model_solved = false;
+	Status s = solveWithCallbacks(NULL, NULL, false, k == n - 1);
+
+	if(s.error_code == 0) {
+	  objective_values[k] = solver.getObjValue();
+
+	  if(n_v != 0) {
+	    solver.getValues(v_vars, v_values);
+
+	    for(long i = 0; i < n_v; ++i)
+	      values[k*n_v + i] = v_values[i];
+	  }
+	} else if(s.error_code == MODEL_UNBOUNDED || s.error_code == MODEL_INFEASABLE 
+		  || s.error_code == MODEL_UNBOUNDED_OR_INFEASABLE
+		  || s.error_code == MODEL_LIMIT_REACHED) {
+	  objective_values[k] = IloNan;
+
+	  for(long i = 0; i < n_v; ++i)
+	    values[k*n_v + i] = IloNan;
+	} else {
+	  status = s;
+	}
+      }
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    c_vars.end();
+    c_values.end();
+    ranges.end();
+    lbs.end();
+    ubs.end();
+    v_vars.end();
+    v_values.end();
+
+    return status;
+  }
+
+  // Progress monitoring; see progress.hpp.  A capacity of 0 turns it
+  // off.  Takes effect with the next solve.
+  void setProgressMonitor(long capacity, bool copy_incumbent)
+  {
+    EnvLock lock(env);
+
+    SharedPointer<ProgressMonitor> monitor;
+
+    if(capacity > 0)
+      monitor = SharedPointer<ProgressMonitor>(new ProgressMonitor(capacity, copy_incumbent));
+
+    pthread_mutex_lock(&progress_lock);
+    progress = monitor;
+    pthread_mutex_unlock(&progress_lock);
+  }
+
+  // The functions below never take the environment lock, so they may
+  // be called while another thread is solving the model.
+  bool progressEnabled()
+  {
+    return currentProgressMonitor() != NULL;
+  }
+
+  long progressAvailable()
+  {
+    SharedPointer<ProgressMonitor> monitor = currentProgressMonitor();
+    return (monitor == NULL) ? 0 : monitor->available();
+  }
+
+  long progressDropped()
+  {
+    SharedPointer<ProgressMonitor> monitor = currentProgressMonitor();
+    return (monitor == NULL) ? 0 : monitor->dropped();
+  }
+
+  long getProgress(ProgressSample* dest, long max_samples)
+  {
+    // Held while reading, so there is only ever one reader
+    pthread_mutex_lock(&progress_lock);
+
+    long n = (progress == NULL) ? 0 : progress->pop(dest, max_samples);
+
+    pthread_mutex_unlock(&progress_lock);
+
+    return n;
+  }
+
+  long getIncumbent(double* dest, long n, double* objective)
+  {
+    SharedPointer<ProgressMonitor> monitor = currentProgressMonitor();
+    return (monitor == NULL) ? -1 : monitor->getIncumbent(dest, n, objective);
+  }
+
+  Status readBasis(const char* filename)
+  {
+    EnvLock lock(env);
+
+    try{
+      solver.readBasis(filename);
+    }
+    catch(IloException& e){
+      return Status(e.getMessage());
+    }
+    return Status();
+  }
+
+  Status writeBasis(const char* filename)
+  {
+    EnvLock lock(env);
+
+    try{
+      solver.writeBasis(filename);
+    }
+    catch(IloException& e){
+      return Status(e.getMessage());
+    }
+    return Status();
+  }
+
+  // Creates a new model interface in the same environment, holding
+  // the same variables, constraints and objective, already extracted
+  // and, after an LP solve, starting from the current basis.  Nothing
+  // is copied but the handles, so the clone costs little more than the
+  // extraction; constraints added to either model afterwards are not
+  // seen by the other.
+  Status clone(CPlexModelInterface** dest) const
+  {
+    EnvLock lock(env);
+
+    CPlexModelInterface* c = NULL;
+
+    try {
+      c = new CPlexModelInterface(env);
+
+      for(list<ExpressionArray>::const_iterator it = variable_blocks.begin();
+	  it != variable_blocks.end(); ++it) {
+	c->model.add(it->variables());
+	c->variable_blocks.push_back(*it);
+      }
+
+      for(list<ConstraintArray>::const_iterator it = constraint_blocks.begin();
+	  it != constraint_blocks.end(); ++it) {
+	c->model.add(it->constraint());
+	c->constraint_blocks.push_back(*it);
+      }
+
+      // Pooled constraints go to the clone's solver on extraction
+      c->lazy_blocks = lazy_blocks;
+      c->user_cut_blocks = user_cut_blocks;
+
+      // Each model ends its own objective, so it gets a new one
+      if(current_objective != NULL) {
+	if(objective_owned) {
+	  IloExpr own(env.env());
+	  own += current_objective->getExpr();
+	  c->current_objective = new IloObjective(env.env(), own, current_objective->getSense());
+	  own.end();
+	} else {
+	  c->current_objective = new IloObjective(
+	      env.env(), current_objective->getExpr(), current_objective->getSense());
+	}
+
+	c->model.add(*c->current_objective);
+	c->objective_source = objective_source;
+	c->objective_owned = objective_owned;
+      }
+
+      c->imported_blocks = imported_blocks;
+      c->imported_objective = imported_objective;
+      c->imported_maximize = imported_maximize;
+
+      c->extractModel();
+    } catch(IloException& e) {
+      delete c;
+      return Status(e.getMessage());
+    }
+
+    if(model_solved && !solver.isMIP()) {
+      IloNumVarArray vars(env.env());
+      IloConstraintArray cstrs(env.env());
+      IloCplex::BasisStatusArray vstat(env.env());
+      IloCplex::BasisStatusArray cstat(env.env());
+
+      try {
+	collectBasisExtractables(vars, cstrs);
+	solver.getBasisStatuses(vstat, vars, cstat, cstrs);
+	c->solver.setBasisStatuses(vstat, vars, cstat, cstrs);
+      } catch(IloException&) {
+	// The clone just starts from scratch
+      }
+
+      vars.end();
+      cstrs.end();
+      vstat.end();
+      cstat.end();
+    }
+
+    *dest = c;
+
+    return Status();
+  }
+
+  // Writes the model in the format given by the extension of
+  // filename: .sav, .mps or .lp, optionally followed by .gz.
+  Status exportModel(const char* filename)
+  {
+    EnvLock lock(env);
+
+    try {
+      if(!model_extracted)
+	extractModel();
+
+      solver.exportModel(filename);
+    } catch(IloException& e) {
+      return Status(e.getMessage());
+    }
+
+    return Status();
+  }
+
+  // Reads a model into this one, which must be empty.  The variables
+  // are grouped back into blocks by their names, as given by
+  // CPlexModel.new; see importedBlock().  All the constraints go into
+  // one block, and the objective is kept in importedObjective().
+  Status importModel(const char* filename)
+  {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_CONSTRAIN);
+
+    if(!variable_blocks.empty() || !constraint_blocks.empty() || !lazy_blocks.empty()
+       || !user_cut_blocks.empty() || current_objective != NULL)
+      return Status("A model can only be read into an empty model.");
+
+    IloObjective obj(env.env());
+    IloNumVarArray vars(env.env());
+    IloRangeArray ranges(env.env());
+
+    Status status;
+
+    try {
+      solver.importModel(model, filename, obj, vars, ranges);
+
+      current_objective = new IloObjective(obj);
+      objective_owned = false;
+      imported_maximize = (obj.getSense() == IloObjective::Maximize);
+
+      imported_objective = SharedPointer<ExpressionArray>(
+          new ExpressionArray(env, MetaData(MATRIX_MODE, 1, 1)));
+      (*imported_objective)(0,0) = obj.getExpr();
+      objective_source = imported_objective;
+
+      groupImportedVariables(vars);
+
+      ConstraintArray cstr(env, MetaData(MATRIX_MODE, ranges.getSize(), 1));
+
+      for(long i = 0; i < ranges.getSize(); ++i)
+	cstr(i,0) = ranges[i];
+
+      constraint_blocks.push_back(cstr);
+      countStat(env.stats().constraints_added, ranges.getSize());
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    vars.end();
+    ranges.end();
+
+    return status;
+  }
+
+  long numImportedBlocks() const
+  {
+    return imported_blocks.size();
+  }
+
+  // Returns a new expression holding the i-th block found by
+  // importModel, with the name and the name mode (VAR_NAME_*) it was
+  // recognized by.
+  ExpressionArray* importedBlock(long i, string* name, int* name_mode) const
+  {
+    EnvLock lock(env);
+
+    const ImportedBlock& b = imported_blocks[i];
+
+    *name = b.name;
+    *name_mode = b.name_mode;
+
+    return new ExpressionArray(b.block);
+  }
+
+  // The objective read by importModel, or NULL if there is none.
+  ExpressionArray* importedObjective() const
+  {
+    EnvLock lock(env);
+
+    if(imported_objective == NULL)
+      return NULL;
+
+    return new ExpressionArray(*imported_objective);
+  }
+
+  bool importedObjectiveMaximizes() const
+  {
+    return imported_maximize;
+  }
+
+  // Basis statuses, as IloCplex::BasisStatus codes, for all the
+  // variables in the order they were added followed by all the
+  // constraints currently in the model.
+  long getNumVariables() const
+  {
+    EnvLock lock(env);
+
+    long n = 0;
+
+    for(list<ExpressionArray>::const_iterator it = variable_blocks.begin();
+	it != variable_blocks.end(); ++it)
+      n += it->variables().getSize();
+
+    return n;
+  }
+
+  long getNumConstraints() const
+  {
+    EnvLock lock(env);
+
+    long n = 0;
+
+    for(list<ConstraintArray>::const_iterator it = constraint_blocks.begin();
+	it != constraint_blocks.end(); ++it)
+      n += it->constraint().getSize();
+
+    return n;
+  }
+
+  Status getBasis(int* var_status, long n_vars, int* cstr_status, long n_cstr)
+  {
+    EnvLock lock(env);
+
+    if(!model_solved)
+      return Status("Basis is only available after the model has been solved.");
+
+    IloNumVarArray vars(env.env());
+    IloConstraintArray cstrs(env.env());
+    IloCplex::BasisStatusArray vstat(env.env());
+    IloCplex::BasisStatusArray cstat(env.env());
+
+    Status status;
+
+    try {
+      collectBasisExtractables(vars, cstrs);
+
+      if(vars.getSize() != n_vars || cstrs.getSize() != n_cstr) {
+	status = Status("Basis size does not match the model.");
+      } else {
+	solver.getBasisStatuses(vstat, vars, cstat, cstrs);
+
+	for(long i = 0; i < n_vars; ++i)
+	  var_status[i] = vstat[i];
+
+	for(long i = 0; i < n_cstr; ++i)
+	  cstr_status[i] = cstat[i];
+      }
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    vars.end();
+    cstrs.end();
+    vstat.end();
+    cstat.end();
+
+    return status;
+  }
+
+  Status setBasis(const int* var_status, long n_vars, const int* cstr_status, long n_cstr)
+  {
+    EnvLock lock(env);
+
+    IloNumVarArray vars(env.env());
+    IloConstraintArray cstrs(env.env());
+    IloCplex::BasisStatusArray vstat(env.env(), n_vars);
+    IloCplex::BasisStatusArray cstat(env.env(), n_cstr);
+
+    Status status;
+
+    try {
+      if(!model_extracted)
+	extractModel();
+
+      collectBasisExtractables(vars, cstrs);
+
+      if(vars.getSize() != n_vars || cstrs.getSize() != n_cstr) {
+	status = Status("Basis size does not match the model.");
+      } else {
+	for(long i = 0; i < n_vars; ++i)
+	  vstat[i] = IloCplex::BasisStatus(var_status[i]);
+
+	for(long i = 0; i < n_cstr; ++i)
+	  cstat[i] = IloCplex::BasisStatus(cstr_status[i]);
+
+	solver.setBasisStatuses(vstat, vars, cstat, cstrs);
+      }
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    vars.end();
+    cstrs.end();
+    vstat.end();
+    cstat.end();
+
+    return status;
+  }
+
+  void getSolveInfo(SolveInfo* dest) const
+  {
+    EnvLock lock(env);
+
+    *dest = last_solve;
+  }
+
+  double getObjectiveValue()
+  {
+    EnvLock lock(env);
+
+    if(!model_solved)
+      return 0;
+	    
+    return solver.getObjValue();
+  }
+
+  Status getValues(NumericalArray& dest, const ExpressionArray& expr)
+  {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_RETRIEVE);
+
+    assert_equal(dest.shape(0), expr.shape(0));
+    assert_equal(dest.shape(1), expr.shape(1));
+	    
+    // if(!model_solved)
+    // 	return Status("Cannot get value; model not in a solved state.");
+		    
+    try{
+      // Plain variables are read from the values of the last solve
+      if(expr.hasVar()) {
+	const double* values = cachedValues(expr.variables());
+
+	if(values != NULL) {
+	  for(long i = 0; i < dest.shape(0); ++i)
+	    for(long j = 0; j < dest.shape(1); ++j)
+	      dest(i,j) = values[expr.getIndex(i,j)];
+
+	  return Status();
+	}
+      }
+
+      for(long i = 0; i < dest.shape(0); ++i)
+	for(long j = 0; j < dest.shape(1); ++j)
+	  dest(i,j) = solver.getValue(expr(i,j));
+    }
+    catch(IloException& e){
+      return Status(e.getMessage());
+    }
+	    
+    return Status();
+  }
+
+  // Dual values and slacks of each constraint in cstr, and reduced
+  // costs of each variable in expr, written into dest with one call
+  // into CPlex each.
+  Status getDuals(NumericalArray& dest, const ConstraintArray& cstr)
+  {
+    return getRangeValues(dest, cstr, true);
+  }
+
+  Status getSlacks(NumericalArray& dest, const ConstraintArray& cstr)
+  {
+    return getRangeValues(dest, cstr, false);
+  }
+
+  Status getReducedCosts(NumericalArray& dest, const ExpressionArray& expr)
+  {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_RETRIEVE);
+
+    assert_equal(dest.shape(0), expr.shape(0));
+    assert_equal(dest.shape(1), expr.shape(1));
+
+    if(!model_solved)
+      return Status("Model not in a solved state.");
+
+    if(!expr.hasVar())
+      return Status("Reduced costs are only defined for variables, not expressions.");
+
+    IloNumVarArray vars(env.env(), dest.size());
+    IloNumArray values(env.env());
+
+    Status status;
+
+    try {
+      const IloNumVarArray& block = expr.variables();
+
+      for(long i = 0; i < dest.shape(0); ++i)
+	for(long j = 0; j < dest.shape(1); ++j)
+	  vars[i*dest.shape(1) + j] = block[expr.getIndex(i,j)];
+
+      solver.getReducedCosts(values, vars);
+
+      for(long i = 0; i < dest.shape(0); ++i)
+	for(long j = 0; j < dest.shape(1); ++j)
+	  dest(i,j) = values[i*dest.shape(1) + j];
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    vars.end();
+    values.end();
+
+    return status;
+  }
+
+  // Fills the solution pool with up to the number of solutions given
+  // by the pool parameters, starting from the current one.
+  Status populate(IloNum* elapsed_time = NULL)
+  {
+    EnvLock lock(env);
+
+    return solveWithCallbacks(elapsed_time, NULL, true);
+  }
+
+  // The solutions in the pool, as left by the last solve or populate
+  long getNumPoolSolutions() const
+  {
+    EnvLock lock(env);
+
+    if(!model_solved)
+      return 0;
+
+    try {
+      return solver.getSolnPoolNsolns();
+    } catch(IloException&) {
+      return 0;
+    }
+  }
+
+  Status getPoolObjectives(double* dest, long n_solutions) const
+  {
+    EnvLock lock(env);
+
+    if(!model_solved)
+      return Status("Model not in a solved state.");
+
+    try {
+      for(long k = 0; k < n_solutions; ++k)
+	dest[k] = solver.getObjValue(k);
+    } catch(IloException& e) {
+      return Status(e.getMessage());
+    }
+
+    return Status();
+  }
+
+  // Writes the values of expr in each of the first n_solutions pool
+  // solutions to dest, one solution after another, each in row major
+  // order.  Variable blocks take one call into CPlex per solution.
+  Status getPoolValues(double* dest, long n_solutions, const ExpressionArray& expr) const
+  {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_RETRIEVE);
+
+    if(!model_solved)
+      return Status("Model not in a solved state.");
+
+    const long n = expr.shape(0) * expr.shape(1);
+
+    IloNumVarArray vars(env.env());
+    IloNumArray values(env.env());
+
+    Status status;
+
+    try {
+      if(expr.hasVar()) {
+	collectVariables(vars, expr);
+
+	for(long k = 0; k < n_solutions; ++k) {
+	  solver.getValues(vars, values, k);
+
+	  for(long i = 0; i < n; ++i)
+	    dest[k*n + i] = values[i];
+	}
+      } else {
+	for(long k = 0; k < n_solutions; ++k)
+	  for(long i = 0; i < expr.shape(0); ++i)
+	    for(long j = 0; j < expr.shape(1); ++j)
+	      dest[k*n + i*expr.shape(1) + j] = solver.getValue(expr(i,j), k);
+      }
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    vars.end();
+    values.end();
+
+    return status;
+  }
+
+  long getNIterations() const
+  {
+    EnvLock lock(env);
+
+    if(solved())
       return solver.getNiterations();
     else
       return 0;
   }
 
-  bool solved() const { return model_solved; }
-	
-  string asString() const
+  bool solved() const { return model_solved; }
+
+  long getMemoryUsage() const
+  {
+    EnvLock lock(env);
+
+    return env.getMemoryUsage();
+  }
+
+  const ModelEnv& getEnv() const
+  {
+    return env;
+  }
+	
+  string asString() const
+  {
+    EnvLock lock(env);
+
+    ostringstream constraints;
+    ostringstream objective;
+
+    for(IloModel::Iterator it(model); it.ok(); ++it){
+      if( (*it).isObjective())
+	{
+	  IloObjective obj = (*it).asObjective();
+		    
+	  objective << ( (obj.getSense() == IloObjective::Maximize) 
+			 ? "maximize " : "minimize ")
+		    << obj.getExpr() << " such that\n  ";
+	}
+      else
+	constraints << (*it) << "\n  ";
+    }
+	    
+    objective << constraints.str();
+    return objective.str();
+  }
+
+private:
+
+  // Ends the model once the environment is free; see ModelEnv.
+  class PendingModelEnd : public PendingEnd {
+  public:
+    PendingModelEnd(IloModel _model, IloCplex _solver, IloCplex::Aborter _aborter, 
+		    IloNumVarArray _start_vars, IloNumArray _start_values,
+		    IloObjective* _objective)
+      : model(_model), solver(_solver), aborter(_aborter), 
+	start_vars(_start_vars), start_values(_start_values), objective(_objective)
+    {
+    }
+
+    void end()
+    {
+      try {
+	if(objective != NULL) {
+	  objective->end();
+	  delete objective;
+	}
+
+	solver.end();
+	aborter.end();
+	start_vars.end();
+	start_values.end();
+	model.end();
+      } catch(IloException&) {
+      }
+    }
+
+  private:
+    IloModel model;
+    IloCplex solver;
+    IloCplex::Aborter aborter;
+    IloNumVarArray start_vars;
+    IloNumArray start_values;
+    IloObjective* objective;
+  };
+
+  Status getRangeValues(NumericalArray& dest, const ConstraintArray& cstr, bool duals)
+  {
+    EnvLock lock(env);
+    PhaseTimer timer(env.stats(), PHASE_RETRIEVE);
+
+    assert_equal(dest.shape(0), cstr.shape(0));
+    assert_equal(dest.shape(1), cstr.shape(1));
+
+    if(!model_solved)
+      return Status("Model not in a solved state.");
+
+    IloRangeArray ranges(env.env(), dest.size());
+    IloNumArray values(env.env());
+
+    Status status;
+
+    try {
+      for(long i = 0; i < dest.shape(0) && status.error_code == 0; ++i) {
+	for(long j = 0; j < dest.shape(1); ++j) {
+	  IloRangeI* r = dynamic_cast<IloRangeI*>(cstr(i,j).getImpl());
+
+	  if(r == NULL) {
+	    status = Status("Only linear constraints have duals and slacks.");
+	    break;
+	  }
+
+	  ranges[i*dest.shape(1) + j] = IloRange(r);
+	}
+      }
+
+      if(status.error_code == 0) {
+	if(duals)
+	  solver.getDuals(values, ranges);
+	else
+	  solver.getSlacks(values, ranges);
+
+	for(long i = 0; i < dest.shape(0); ++i)
+	  for(long j = 0; j < dest.shape(1); ++j)
+	    dest(i,j) = values[i*dest.shape(1) + j];
+      }
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    ranges.end();
+    values.end();
+
+    return status;
+  }
+
+  // The progress monitor and the separator are fed by callbacks
+  // installed for one solve only.
+  Status solveWithCallbacks(IloNum * elapsed_time, SolveAborter* control, bool populate,
+			    bool snapshot = true)
   {
-    ostringstream constraints;
-    ostringstream objective;
+    SharedPointer<ProgressMonitor> monitor = currentProgressMonitor();
 
-    for(IloModel::Iterator it(model); it.ok(); ++it){
-      if( (*it).isObjective())
+    if(monitor == NULL && separate_function == NULL)
+      return runSolve(elapsed_time, control, snapshot, populate);
+
+    IloNumVarArray vars(env.env());
+    IloNumVarArray separate_vars(env.env());
+    vector<IloCplex::Callback> callbacks;
+
+    Status status;
+
+    try {
+      if(monitor != NULL) {
+	for(list<ExpressionArray>::const_iterator it = variable_blocks.begin();
+	    it != variable_blocks.end(); ++it)
+	  vars.add(it->variables());
+
+	callbacks.push_back(solver.use(IloCplex::Callback(
+	    new (env.env()) ProgressCallbackI(env.env(), &(*monitor), vars))));
+      }
+
+      if(separate_function != NULL) {
+	for(list<ExpressionArray>::const_iterator it = separate_blocks.begin();
+	    it != separate_blocks.end(); ++it)
+	  collectVariables(separate_vars, *it);
+
+	callbacks.push_back(solver.use(IloCplex::Callback(
+	    new (env.env()) LazySeparatorI(env, separate_function, separate_handler,
+					   &separate_lock, separate_vars))));
+      }
+    } catch(IloException& e) {
+      status = Status(e.getMessage());
+    }
+
+    if(status.error_code == 0) {
+      env.lendToCallbacks(separate_function != NULL);
+      status = runSolve(elapsed_time, control, snapshot, populate);
+      env.lendToCallbacks(false);
+    }
+
+    for(size_t i = 0; i < callbacks.size(); ++i) {
+      try {
+	solver.remove(callbacks[i]);
+	callbacks[i].end();
+      } catch(IloException&) {
+      }
+    }
+
+    vars.end();
+    separate_vars.end();
+
+    return status;
+  }
+
+  Status runSolve(IloNum * elapsed_time, SolveAborter* control, bool snapshot = true,
+		  bool populate = false)
+  {
+    // The Threads parameter to put back after solving with a grant
+    IloInt restore_threads = -1;
+
+    try{
+      if(!model_extracted)
+	extractModel();
+
+      aborter.clear();
+      value_cache_valid = false;
+      clearSolveInfo();
+
+      if(control != NULL && !control->attach(&aborter))
+	return Status("Solve aborted.", MODEL_ABORTED);
+
+      ThreadGrant grant;
+
+      if(ThreadBudget::global().enabled()) {
+	restore_threads = solver.getParam(IloCplex::Threads);
+
+	bool granted = grant.acquire(restore_threads, 
+				     control == NULL ? NULL : &control->requested);
+
+	last_solve.queue_wait = grant.waitNanoseconds() * 1e-9;
+	countStat(env.stats().queue_wait_ns, grant.waitNanoseconds());
+
+	if(!granted) {
+	  // Only a SolveAborter stops the wait
+	  control->detach();
+	  last_solve.outcome = SOLVE_ABORTED;
+	  return Status("Solve aborted.", MODEL_ABORTED);
+	}
+
+	solver.setParam(IloCplex::Threads, grant.threads());
+	last_solve.threads = grant.threads();
+      }
+    
+      if(elapsed_time != NULL)
+	*elapsed_time = -solver.getImpl()->getCplexTime();
+
+      bool found;
+      double det_start = solver.getDetTime();
+
+      {
+	PhaseTimer timer(env.stats(), PHASE_SOLVE);
+	found = populate ? solver.populate() : solver.solve();
+      }
+
+      env.stats().det_ticks += solver.getDetTime() - det_start;
+      countStat(env.stats().iterations, solver.getNiterations());
+
+      if(control != NULL)
+	control->detach();
+
+      if(restore_threads >= 0)
+	solver.setParam(IloCplex::Threads, restore_threads);
+
+      recordSolveInfo(found);
+
+      if(! found )
 	{
-	  IloObjective obj = (*it).asObjective();
-		    
-	  objective << ( (obj.getSense() == IloObjective::Maximize) 
-			 ? "maximize " : "minimize ")
-		    << obj.getExpr() << " such that\n  ";
+	  if(elapsed_time != NULL)
+	    *elapsed_time = 0;
+
+	  switch(last_solve.outcome) {
+	  case SOLVE_ABORTED:
+	    return Status("Solve aborted.", MODEL_ABORTED);
+	  case SOLVE_UNBOUNDED:
+	    return Status("Model unbounded.", MODEL_UNBOUNDED);
+	  case SOLVE_INFEASIBLE:
+	    return Status("Model infeasible.", MODEL_INFEASABLE);
+	  case SOLVE_INFEASIBLE_OR_UNBOUNDED:
+	    return Status("Model unbounded or infeasable.", MODEL_UNBOUNDED_OR_INFEASABLE);
+	  case SOLVE_LIMIT_REACHED:
+	    return Status("Limit reached before a solution was found.", MODEL_LIMIT_REACHED);
+	  default:
+	    return Status("Unknown error occured while solving model.");
+	  }
 	}
-      else
-	constraints << (*it) << "\n  ";
+
+      if(elapsed_time != NULL)
+	*elapsed_time += solver.getImpl()->getCplexTime();
+    }
+    catch(IloException& e){
+      if(control != NULL)
+	control->detach();
+
+      if(restore_threads >= 0) {
+	try {
+	  solver.setParam(IloCplex::Threads, restore_threads);
+	} catch(IloException&) {
+	}
+      }
+
+      return Status(e.getMessage());
     }
 	    
-    objective << constraints.str();
-    return objective.str();
+    model_solved = true;
+
+    if(snapshot)
+      snapshotValues();
+
+    return Status();
   }
 
-private:
+  void clearSolveInfo()
+  {
+    last_solve.outcome = SOLVE_NONE;
+    last_solve.cplex_status = 0;
+    last_solve.objective = IloNan;
+    last_solve.best_bound = IloNan;
+    last_solve.gap = IloNan;
+    last_solve.nodes = 0;
+    last_solve.threads = 0;
+    last_solve.queue_wait = 0;
+  }
+
+  void recordSolveInfo(bool found)
+  {
+    SolveInfo& info = last_solve;
+
+    IloAlgorithm::Status status = solver.getStatus();
+    IloCplex::CplexStatus cplex_status = solver.getCplexStatus();
+
+    info.cplex_status = int(cplex_status);
+
+    if(found) {
+      info.outcome = (status == IloAlgorithm::Optimal) ? SOLVE_OPTIMAL : SOLVE_FEASIBLE;
+    } else if(cplex_status == IloCplex::AbortUser) {
+      info.outcome = SOLVE_ABORTED;
+    } else {
+      switch(status) {
+      case IloAlgorithm::Unbounded:
+	info.outcome = SOLVE_UNBOUNDED;
+	break;
+      case IloAlgorithm::Infeasible:
+	info.outcome = SOLVE_INFEASIBLE;
+	break;
+      case IloAlgorithm::InfeasibleOrUnbounded:
+	info.outcome = SOLVE_INFEASIBLE_OR_UNBOUNDED;
+	break;
+      case IloAlgorithm::Unknown:
+	// Stopped by a limit before anything was concluded
+	info.outcome = SOLVE_LIMIT_REACHED;
+	break;
+      default:
+	info.outcome = SOLVE_ERROR;
+	break;
+      }
+    }
+
+    // Some of these are not defined for every problem type or status
+    try {
+      if(found)
+	info.objective = solver.getObjValue();
+
+      if(solver.isMIP()) {
+	info.nodes = solver.getNnodes();
+	info.best_bound = solver.getBestObjValue();
+
+	if(found)
+	  info.gap = solver.getMIPRelativeGap();
+      } else if(info.outcome == SOLVE_OPTIMAL) {
+	info.best_bound = info.objective;
+	info.gap = 0;
+      }
+    } catch(IloException&) {
+    }
+  }
+
+  // Gathers the variables of expr in row major order
+  static void collectVariables(IloNumVarArray& vars, const ExpressionArray& expr)
+  {
+    const IloNumVarArray& block = expr.variables();
+
+    for(long i = 0; i < expr.shape(0); ++i)
+      for(long j = 0; j < expr.shape(1); ++j)
+	vars.add(block[expr.getIndex(i,j)]);
+  }
+
+  // A model and its clones hold the same constraints and variables, so
+  // changing their bounds in place would change all of them.
+  bool sharedWithClones() const
+  {
+    return env.numModels() > 1;
+  }
+
+  // The objective shares its expression with the one it was created
+  // from until it gets its own copy here.
+  void ownObjective()
+  {
+    if(objective_owned)
+      return;
+
+    IloExpr own(env.env());
+    own += current_objective->getExpr();
+    current_objective->setExpr(own);
+    own.end();
+
+    objective_owned = true;
+  }
+
+  // The ranges of cstr, in row major order, with their current bounds
+  Status collectRHSRanges(const ConstraintArray& cstr, IloRangeArray& ranges,
+			  IloNumArray& lbs, IloNumArray& ubs) const
+  {
+    for(long i = 0; i < cstr.shape(0); ++i) {
+      for(long j = 0; j < cstr.shape(1); ++j) {
+	IloRangeI* r = dynamic_cast<IloRangeI*>(cstr(i,j).getImpl());
+
+	if(r == NULL)
+	  return Status("Only linear constraints have a right hand side.");
+
+	IloRange range(r);
+	IloNum lb = range.getLB(), ub = range.getUB();
+
+	if(lb != ub && lb > -IloInfinity && ub < IloInfinity)
+	  return Status("Right hand side of a ranged constraint is ambiguous.");
+
+	ranges.add(range);
+	lbs.add(lb);
+	ubs.add(ub);
+      }
+    }
+
+    return Status();
+  }
+
+  // The upper bound of <= constraints, the lower bound of >=
+  // constraints and both for equalities
+  static void setRHS(IloNum& lb, IloNum& ub, IloNum v)
+  {
+    if(lb == ub)
+      lb = ub = v;
+    else if(lb <= -IloInfinity)
+      ub = v;
+    else
+      lb = v;
+  }
+
+  void collectBasisExtractables(IloNumVarArray& vars, IloConstraintArray& cstrs) const
+  {
+    for(list<ExpressionArray>::const_iterator it = variable_blocks.begin();
+	it != variable_blocks.end(); ++it)
+      vars.add(it->variables());
+
+    for(list<ConstraintArray>::const_iterator it = constraint_blocks.begin();
+	it != constraint_blocks.end(); ++it)
+      cstrs.add(it->constraint());
+  }
+
+  // Takes the values of all variables in one call, so reading them
+  // back afterwards needs no further calls into CPlex.
+  void snapshotValues()
+  {
+    PhaseTimer timer(env.stats(), PHASE_RETRIEVE);
+
+    IloNumVarArray all_vars(env.env());
+    IloNumArray all_values(env.env());
+
+    value_offsets.clear();
+
+    for(list<ExpressionArray>::const_iterator it = variable_blocks.begin();
+	it != variable_blocks.end(); ++it) {
+      value_offsets[it->variables().getImpl()] = all_vars.getSize();
+      all_vars.add(it->variables());
+    }
+
+    try {
+      solver.getValues(all_vars, all_values);
+
+      value_cache.resize(all_values.getSize());
+
+      for(long i = 0; i < all_values.getSize(); ++i)
+	value_cache[i] = all_values[i];
+
+      value_cache_valid = true;
+    } catch(IloException&) {
+      value_cache_valid = false;
+    }
+
+    all_vars.end();
+    all_values.end();
+  }
+
+  // Returns the values of the block vars from the last solve, or NULL
+  // if they're not in the snapshot.
+  const double* cachedValues(const IloNumVarArray& vars) const
+  {
+    if(!model_solved || !value_cache_valid || value_cache.empty())
+      return NULL;
+
+    map<const void*, long>::const_iterator it = value_offsets.find(vars.getImpl());
+
+    if(it == value_offsets.end() || it->second + vars.getSize() > (long)value_cache.size())
+      return NULL;
+
+    return &value_cache[it->second];
+  }
+
+  // Splits a name given by CPlexModel.new into the block name and
+  // the index of the variable within the block.
+  static int parseVariableName(const char* name, string* base, long* i, long* j)
+  {
+    *i = *j = 0;
+
+    if(name == NULL) {
+      *base = "";
+      return VAR_NAME_SCALAR;
+    }
+
+    const char* bracket = strchr(name, '[');
+    char end_c;
+
+    if(bracket != NULL) {
+      if(sscanf(bracket, "[%ld,%ld%c", i, j, &end_c) == 3 && end_c == ']') {
+	*base = string(name, bracket);
+	return VAR_NAME_MATRIX;
+      }
+
+      if(sscanf(bracket, "[%ld%c", i, &end_c) == 2 && end_c == ']') {
+	*base = string(name, bracket);
+	return VAR_NAME_ARRAY;
+      }
+    }
+
+    *i = *j = 0;
+    *base = name;
+    return VAR_NAME_SCALAR;
+  }
+
+  // Variables sharing a block name and index form, wherever they are
+  // in the file, become one block, each placed by its indices.  If the
+  // indices leave gaps or repeat, or there are none, each of those
+  // variables becomes a scalar block of its own, named in full.
+  void groupImportedVariables(const IloNumVarArray& vars)
+  {
+    const long n = vars.getSize();
+
+    vector<string> bases(n);
+    vector<int> modes(n);
+    vector<long> rows(n), cols(n);
+
+    // Groups in the order their first variable appears
+    vector<vector<long> > groups;
+    map<pair<string, int>, size_t> group_of;
+
+    for(long k = 0; k < n; ++k) {
+      modes[k] = parseVariableName(vars[k].getName(), &bases[k], &rows[k], &cols[k]);
+
+      if(modes[k] == VAR_NAME_SCALAR) {
+	groups.push_back(vector<long>(1, k));
+	continue;
+      }
+
+      pair<string, int> key(bases[k], modes[k]);
+      map<pair<string, int>, size_t>::iterator it = group_of.find(key);
+
+      if(it == group_of.end()) {
+	group_of[key] = groups.size();
+	groups.push_back(vector<long>(1, k));
+      } else {
+	groups[it->second].push_back(k);
+      }
+    }
+
+    for(size_t g = 0; g < groups.size(); ++g) {
+      const vector<long>& members = groups[g];
+      const long count = members.size();
+      int mode = modes[members[0]];
+
+      // The position of each member in the block, row by row
+      vector<long> order(count, -1);
+      long shape_0 = 0, shape_1 = 0;
+      bool placed = (mode != VAR_NAME_SCALAR);
+
+      for(long k = 0; k < count && placed; ++k) {
+	if(rows[members[k]] < 0 || cols[members[k]] < 0)
+	  placed = false;
+
+	shape_0 = max(shape_0, rows[members[k]] + 1);
+	shape_1 = max(shape_1, cols[members[k]] + 1);
+      }
+
+      placed = placed && shape_0 * shape_1 == count;
+
+      for(long k = 0; k < count && placed; ++k) {
+	long pos = rows[members[k]] * shape_1 + cols[members[k]];
+
+	if(order[pos] != -1)
+	  placed = false;
+	else
+	  order[pos] = members[k];
+      }
+
+      if(placed) {
+	IloNumVarArray block_vars(env.env(), count);
+
+	for(long k = 0; k < count; ++k)
+	  block_vars[k] = vars[order[k]];
+
+	addImportedBlock(block_vars, bases[members[0]], mode, shape_0, shape_1);
+	continue;
+      }
+
+      for(long k = 0; k < count; ++k) {
+	IloNumVarArray block_vars(env.env(), 1);
+	block_vars[0] = vars[members[k]];
+
+	const char* name = vars[members[k]].getName();
+
+	addImportedBlock(block_vars, mode == VAR_NAME_SCALAR ? bases[members[k]]
+			 : string(name == NULL ? "" : name), VAR_NAME_SCALAR, 1, 1);
+      }
+    }
+  }
+
+  void addImportedBlock(const IloNumVarArray& block_vars, const string& name, int mode,
+			long shape_0, long shape_1)
+  {
+    ExpressionArray block(env, block_vars, MetaData(MATRIX_MODE, shape_0, shape_1));
+
+    variable_blocks.push_back(block);
+    imported_blocks.push_back(ImportedBlock(block, name, mode));
+  }
+
+  SharedPointer<ProgressMonitor> currentProgressMonitor()
+  {
+    pthread_mutex_lock(&progress_lock);
+    SharedPointer<ProgressMonitor> monitor = progress;
+    pthread_mutex_unlock(&progress_lock);
+
+    return monitor;
+  }
 
   void extractModel() 
   {
+    PhaseTimer timer(env.stats(), PHASE_EXTRACT);
+
     env.setNormalizer(IloFalse);
     solver.extract(model);
+
+    for(list<ConstraintArray>::const_iterator it = lazy_blocks.begin();
+	it != lazy_blocks.end(); ++it)
+      solver.addLazyConstraints(it->constraint());
+
+    for(list<ConstraintArray>::const_iterator it = user_cut_blocks.begin();
+	it != user_cut_blocks.end(); ++it)
+      solver.addUserCuts(it->constraint());
+
     model_extracted = true;
     env.setNormalizer(IloTrue);
   }
 
-  IloEnv env;
+  static bool inPool(const list<ConstraintArray>& blocks, const ConstraintArray& cstr)
+  {
+    for(list<ConstraintArray>::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+      if(&(it->constraint()) == &(cstr.constraint()))
+	return true;
+    }
+
+    return false;
+  }
+
+  static bool removeFromPool(list<ConstraintArray>& blocks, const ConstraintArray& cstr)
+  {
+    for(list<ConstraintArray>::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+      if(&(it->constraint()) == &(cstr.constraint())) {
+	blocks.erase(it);
+	return true;
+      }
+    }
+
+    return false;
+  }
+
+  static long poolSize(const list<ConstraintArray>& blocks)
+  {
+    long n = 0;
+
+    for(list<ConstraintArray>::const_iterator it = blocks.begin(); it != blocks.end(); ++it)
+      n += it->size();
+
+    return n;
+  }
+
+  ModelEnv env;
   IloModel model;
   IloCplex solver;
+  IloCplex::Aborter aborter;
+
+  // The MIP start being put together by addMIPStartValues
+  IloNumVarArray mip_start_vars;
+  IloNumArray mip_start_values;
+
   IloObjective* current_objective;
+  bool objective_owned;
   bool model_extracted;
   bool model_solved;
+
+  // All variable values from the last solve; see snapshotValues().
+  bool value_cache_valid;
+  vector<double> value_cache;
+  map<const void*, long> value_offsets;
+
+  // Keep everything the model uses alive until the model goes
+  list<ExpressionArray> variable_blocks;
+  list<ConstraintArray> constraint_blocks;
+  list<ConstraintArray> lazy_blocks;
+  list<ConstraintArray> user_cut_blocks;
+  SharedPointer<ExpressionArray> objective_source;
+
+  // What importModel found
+  struct ImportedBlock {
+    ImportedBlock(const ExpressionArray& _block, const string& _name, int _name_mode)
+      : block(_block), name(_name), name_mode(_name_mode)
+    {
+    }
+
+    ExpressionArray block;
+    string name;
+    int name_mode;
+  };
+
+  vector<ImportedBlock> imported_blocks;
+  SharedPointer<ExpressionArray> imported_objective;
+  bool imported_maximize;
+
+  // Guards the progress pointer and reads from the monitor
+  pthread_mutex_t progress_lock;
+  SharedPointer<ProgressMonitor> progress;
+
+  SolveInfo last_solve;
+
+  // See setLazySeparator(); the lock keeps calls of the function apart
+  SeparateFunction separate_function;
+  void* separate_handler;
+  list<ExpressionArray> separate_blocks;
+  pthread_mutex_t separate_lock;
 };
 
-inline CPlexModelInterface::Status newCPlexModelInterface(CPlexModelInterface **cpx, IloEnv env)
+inline CPlexModelInterface::Status newCPlexModelInterface(CPlexModelInterface **cpx, const ModelEnv& env)
 {
 
   try {
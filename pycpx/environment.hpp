@@ -0,0 +1,299 @@
+#ifndef _ENVIRONMENT_HPP_
+#define _ENVIRONMENT_HPP_
+
+// Each model owns its own concert environment.  Everything created
+// for that model -- expressions, constraints, the model interface
+// itself -- holds a reference to it, so the environment, and all the
+// memory allocated in it, is ended once the last of them goes away.
+//
+// Concert environments are not thread safe, and most of the work on
+// them is done without holding the GIL, so every operation touching
+// the environment holds its lock (see EnvLock).  The lock is
+// recursive.  Objects released while another thread holds the lock
+// are queued and ended by that thread once it lets go, so dropping a
+// reference never blocks.
+//
+// While a model is being solved, the solving thread holds the lock.
+// Callbacks that build expressions on the solver's threads (see
+// separator.hpp) can only do so if the solving thread lends them the
+// environment; inside a CallbackEnvScope, locking then takes a second
+// lock shared by the callbacks alone.
+
+#include <ilconcert/iloenv.h>
+#include <iostream>
+#include <vector>
+#include <pthread.h>
+
+#include "simple_shared_ptr.h"
+#include "stats.hpp"
+
+using namespace std;
+
+class PendingEnd {
+public:
+    virtual ~PendingEnd() {}
+    virtual void end() = 0;
+};
+
+// The environment lent to the callback running on this thread, if any
+static __thread const void* callback_env = NULL;
+
+class ModelEnv {
+private:
+    struct Holder {
+	Holder()
+	    : env(), depth(0), lent(false), models(0)
+	    {
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&lock, &attr);
+		pthread_mutex_init(&callback_lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+
+		pthread_mutex_init(&pending_lock, NULL);
+	    }
+
+	~Holder()
+	    {
+		flushPending();
+		env.end();
+
+		pthread_mutex_destroy(&pending_lock);
+		pthread_mutex_destroy(&callback_lock);
+		pthread_mutex_destroy(&lock);
+	    }
+
+	void flushPending()
+	    {
+		vector<PendingEnd*> to_end;
+
+		pthread_mutex_lock(&pending_lock);
+		to_end.swap(pending);
+		pthread_mutex_unlock(&pending_lock);
+
+		for(size_t i = 0; i < to_end.size(); ++i)
+		{
+		    to_end[i]->end();
+		    delete to_end[i];
+		}
+	    }
+
+	IloEnv env;
+	pthread_mutex_t lock;
+	long depth;
+
+	pthread_mutex_t callback_lock;
+	volatile bool lent;
+
+	volatile long models;
+
+	pthread_mutex_t pending_lock;
+	vector<PendingEnd*> pending;
+
+	ModelStats stats;
+    };
+
+public:
+    ModelEnv()
+	: _holder(new Holder)
+	{
+	}
+
+    inline IloEnv env() const
+	{
+	    return _holder->env;
+	}
+
+    inline operator IloEnv() const
+	{
+	    return _holder->env;
+	}
+
+    inline void setNormalizer(IloBool normalize) const
+	{
+	    _holder->env.setNormalizer(normalize);
+	}
+
+    inline long getMemoryUsage() const
+	{
+	    return _holder->env.getMemoryUsage();
+	}
+
+    // True if both refer to the same environment
+    inline bool sameAs(const ModelEnv& other) const
+	{
+	    return &(*_holder) == &(*other._holder);
+	}
+
+    // Counts the model interfaces using the environment; there is
+    // more than one once a model has been cloned.
+    void addModel() const
+	{
+	    __sync_add_and_fetch(&_holder->models, 1);
+	}
+
+    void removeModel() const
+	{
+	    __sync_sub_and_fetch(&_holder->models, 1);
+	}
+
+    inline long numModels() const
+	{
+	    return _holder->models;
+	}
+
+    // See stats.hpp
+    inline ModelStats& stats() const
+	{
+	    return _holder->stats;
+	}
+
+    void copyStats(ModelStats* dest) const
+	{
+	    *dest = _holder->stats;
+	}
+
+    void resetStats() const
+	{
+	    lock();
+	    clearStats(_holder->stats);
+	    unlock();
+	}
+
+    inline void lock() const
+	{
+	    if(inLentCallback()) {
+		pthread_mutex_lock(&_holder->callback_lock);
+		return;
+	    }
+
+	    pthread_mutex_lock(&_holder->lock);
+	    ++_holder->depth;
+	}
+
+    // Objects released inside a callback are left to the solving thread
+    inline bool tryLock() const
+	{
+	    if(inLentCallback())
+		return false;
+
+	    if(pthread_mutex_trylock(&_holder->lock) != 0)
+		return false;
+
+	    ++_holder->depth;
+	    return true;
+	}
+
+    inline void unlock() const
+	{
+	    if(inLentCallback()) {
+		pthread_mutex_unlock(&_holder->callback_lock);
+		return;
+	    }
+
+	    if(_holder->depth == 1)
+		_holder->flushPending();
+
+	    --_holder->depth;
+	    pthread_mutex_unlock(&_holder->lock);
+	}
+
+    // Only called by the thread holding the lock, around a solve
+    void lendToCallbacks(bool lend) const
+	{
+	    _holder->lent = lend;
+	}
+
+    // Ends p now if the environment is free, otherwise leaves it to
+    // whoever holds it.  Takes ownership of p.
+    void endLater(PendingEnd* p) const
+	{
+	    pthread_mutex_lock(&_holder->pending_lock);
+	    _holder->pending.push_back(p);
+	    pthread_mutex_unlock(&_holder->pending_lock);
+
+	    if(tryLock())
+		unlock();
+	}
+
+    void setVerbosity(int verbosity) const
+	{
+	    lock();
+
+	    IloEnv env = _holder->env;
+
+	    switch(verbosity) {
+	    case 0:
+		env.setError(env.getNullStream());
+		env.setWarning(env.getNullStream());
+		env.setOut(env.getNullStream());
+		break;
+	    case 1:
+		env.setError(cout);
+		env.setWarning(env.getNullStream());
+		env.setOut(env.getNullStream());
+		break;
+	    case 2:
+		env.setError(cout);
+		env.setWarning(cout);
+		env.setOut(env.getNullStream());
+		break;
+	    default:
+		env.setError(cerr);
+		env.setWarning(cerr);
+		env.setOut(cout);
+		break;
+	    }
+
+	    unlock();
+	}
+
+private:
+    friend class CallbackEnvScope;
+
+    inline bool inLentCallback() const
+	{
+	    return _holder->lent && callback_env == &(*_holder);
+	}
+
+    SharedPointer<Holder> _holder;
+};
+
+// Marks the current thread as running a callback for env, for as long
+// as it exists.
+class CallbackEnvScope {
+public:
+    CallbackEnvScope(const ModelEnv& env)
+	: _previous(callback_env)
+	{
+	    callback_env = &(*env._holder);
+	}
+
+    ~CallbackEnvScope()
+	{
+	    callback_env = _previous;
+	}
+
+private:
+    const void* _previous;
+};
+
+class EnvLock {
+public:
+    EnvLock(const ModelEnv& env)
+	: _env(env)
+	{
+	    _env.lock();
+	}
+
+    ~EnvLock()
+	{
+	    _env.unlock();
+	}
+
+private:
+    const ModelEnv _env;
+};
+
+#endif /* _ENVIRONMENT_HPP_ */
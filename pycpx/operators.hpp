@@ -77,12 +77,19 @@ ExpressionArray* newFromUnaryOp(const ExpressionArray& src, int op_type)
 {
     typedef ExpressionArray::Value Value;
 
+    EnvLock lock(src.getEnv());
+    PhaseTimer timer(src.getEnv().stats(), PHASE_BUILD);
+
     ExpressionArray *dest = new ExpressionArray(src.getEnv(), src.md());
 
+    countStat(src.getEnv().stats().expressions_created, 1);
+    countStat(src.getEnv().stats().terms_emitted, dest->size());
+
     switch(op_type) {
 
     case OP_U_NO_TRANSLATE:
 	unary_op(*dest, src, UOp<OP_U_NO_TRANSLATE, Value, Value>());
+	dest->borrowFrom(src);
 	return dest;
     case OP_U_ABS:
 	unary_op(*dest, src, UOp<OP_U_ABS, Value, Value>());
@@ -162,6 +169,9 @@ ExpressionArray* newFromReduction(const ExpressionArray& src,
 
     ExpressionArray& dest = *dest_ptr;
 
+    // Reductions over a single element hand back the source expression
+    dest.borrowFrom(src);
+
     switch(axis){
     case 0:
 	for(long i = 0; i < src.shape(1); ++i)
@@ -175,6 +185,8 @@ ExpressionArray* newFromReduction(const ExpressionArray& src,
 	reduction_op(dest(0,0), src, SliceFull(src.shape(0)), SliceFull(src.shape(1)), op, is_simple);
 	break;
     }
+
+    countStat(src.getEnv().stats().terms_emitted, dest.size());
     
     return dest_ptr;
 }
@@ -184,6 +196,11 @@ ExpressionArray* newFromReduction(const ExpressionArray& src, int op_type, int a
 {
     typedef ExpressionArray::Value Value;
 
+    EnvLock lock(src.getEnv());
+    PhaseTimer timer(src.getEnv().stats(), PHASE_BUILD);
+
+    countStat(src.getEnv().stats().expressions_created, 1);
+
     bool is_simple = !!(op_type & OP_SIMPLE_FLAG);
     
     switch(op_type & OP_SIMPLE_MASK){
@@ -381,6 +398,36 @@ void binary_op(const int op_type, ConstraintArray& dest, const SA1& src1, const
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// These create the destination and fill it in one go, holding the
+// environment lock throughout, so they can be called without the GIL.
+
+template <typename SA1, typename SA2>
+ExpressionArray* newFromBinaryOp(const int op_type, const MetaData& md, 
+				 const SA1& src1, const SA2& src2)
+{
+    EnvLock lock(src1.getEnv());
+    PhaseTimer timer(src1.getEnv().stats(), PHASE_BUILD);
+
+    ExpressionArray *dest = new ExpressionArray(src1.getEnv(), md);
+    binary_op(op_type, *dest, src1, src2);
+
+    countStat(src1.getEnv().stats().expressions_created, 1);
+    countStat(src1.getEnv().stats().terms_emitted, dest->size());
+
+    return dest;
+}
+
+template <typename SA1, typename SA2>
+ConstraintArray* newConstraintFromBinaryOp(const int op_type, const MetaData& md, 
+					   const SA1& src1, const SA2& src2)
+{
+    EnvLock lock(src1.getEnv());
+    PhaseTimer timer(src1.getEnv().stats(), PHASE_BUILD);
 
+    ConstraintArray *dest = new ConstraintArray(src1.getEnv(), md);
+    binary_op(op_type, *dest, src1, src2);
+    return dest;
+}
 
 #endif
@@ -0,0 +1,102 @@
+#ifndef _PARAMETERS_HPP_
+#define _PARAMETERS_HPP_
+
+// The table of solver parameters that may be set by name from python.
+// Names are those of the concert enums (IloCplex::Threads, etc.) and
+// are looked up without regard to case.
+
+#include <ilcplex/ilocplex.h>
+#include <strings.h>
+
+#define PARAM_UNKNOWN  -1
+#define PARAM_INT       0
+#define PARAM_LONG      1
+#define PARAM_NUM       2
+#define PARAM_BOOL      3
+#define PARAM_STRING    4
+
+struct ParameterEntry {
+    const char* name;
+    int kind;
+    int id;
+};
+
+static const ParameterEntry parameter_table[] = {
+
+    // Algorithms and emphasis
+    {"RootAlg",           PARAM_INT,    IloCplex::RootAlg},
+    {"NodeAlg",           PARAM_INT,    IloCplex::NodeAlg},
+    {"MIPEmphasis",       PARAM_INT,    IloCplex::MIPEmphasis},
+    {"MIPSearch",         PARAM_INT,    IloCplex::MIPSearch},
+    {"AdvInd",            PARAM_INT,    IloCplex::AdvInd},
+    {"PreInd",            PARAM_BOOL,   IloCplex::PreInd},
+    {"Probe",             PARAM_INT,    IloCplex::Probe},
+    {"HeurFreq",          PARAM_LONG,   IloCplex::HeurFreq},
+    {"RandomSeed",        PARAM_INT,    IloCplex::RandomSeed},
+
+    // Parallelism
+    {"Threads",           PARAM_INT,    IloCplex::Threads},
+    {"ParallelMode",      PARAM_INT,    IloCplex::ParallelMode},
+
+    // Memory and node files
+    {"WorkMem",           PARAM_NUM,    IloCplex::WorkMem},
+    {"TreLim",            PARAM_NUM,    IloCplex::TreLim},
+    {"NodeFileInd",       PARAM_INT,    IloCplex::NodeFileInd},
+    {"WorkDir",           PARAM_STRING, IloCplex::WorkDir},
+    {"MemoryEmphasis",    PARAM_BOOL,   IloCplex::MemoryEmphasis},
+
+    // Limits and cutoffs
+    {"TiLim",             PARAM_NUM,    IloCplex::TiLim},
+    {"DetTiLim",          PARAM_NUM,    IloCplex::DetTiLim},
+    {"ClockType",         PARAM_INT,    IloCplex::ClockType},
+    {"NodeLim",           PARAM_LONG,   IloCplex::NodeLim},
+    {"ItLim",             PARAM_LONG,   IloCplex::ItLim},
+    {"CutLo",             PARAM_NUM,    IloCplex::CutLo},
+    {"CutUp",             PARAM_NUM,    IloCplex::CutUp},
+
+    // Tolerances
+    {"EpGap",             PARAM_NUM,    IloCplex::EpGap},
+    {"EpAGap",            PARAM_NUM,    IloCplex::EpAGap},
+    {"EpRHS",             PARAM_NUM,    IloCplex::EpRHS},
+    {"EpOpt",             PARAM_NUM,    IloCplex::EpOpt},
+    {"EpInt",             PARAM_NUM,    IloCplex::EpInt},
+
+    // Solution pool
+    {"SolnPoolCapacity",  PARAM_INT,    IloCplex::SolnPoolCapacity},
+    {"SolnPoolIntensity", PARAM_INT,    IloCplex::SolnPoolIntensity},
+    {"SolnPoolReplace",   PARAM_INT,    IloCplex::SolnPoolReplace},
+    {"SolnPoolGap",       PARAM_NUM,    IloCplex::SolnPoolGap},
+    {"PopulateLim",       PARAM_INT,    IloCplex::PopulateLim},
+
+    // Output
+    {"MIPDisplay",        PARAM_INT,    IloCplex::MIPDisplay},
+};
+
+static const long n_parameters = sizeof(parameter_table) / sizeof(ParameterEntry);
+
+inline const ParameterEntry* findParameter(const char* name)
+{
+    for(long i = 0; i < n_parameters; ++i)
+	if(strcasecmp(parameter_table[i].name, name) == 0)
+	    return &parameter_table[i];
+
+    return NULL;
+}
+
+inline int parameterKind(const char* name)
+{
+    const ParameterEntry* p = findParameter(name);
+    return (p == NULL) ? PARAM_UNKNOWN : p->kind;
+}
+
+inline long numParameters()
+{
+    return n_parameters;
+}
+
+inline const char* parameterName(long i)
+{
+    return parameter_table[i].name;
+}
+
+#endif /* _PARAMETERS_HPP_ */
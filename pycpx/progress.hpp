@@ -0,0 +1,220 @@
+#ifndef _PROGRESS_HPP_
+#define _PROGRESS_HPP_
+
+// Progress reporting from a running solve.  An informational callback
+// pushes samples into a fixed size ring buffer, which python drains
+// from another thread.  Neither side ever waits on the other: the
+// solver's threads reserve a slot with a compare and swap on the head
+// and publish it through the slot's sequence number.  If the buffer
+// fills up, new samples are dropped until it is read again.  The
+// callback can also keep a copy of the incumbent values.
+
+#include <ilcplex/ilocplex.h>
+#include <vector>
+#include <pthread.h>
+
+using namespace std;
+
+// Laid out to match the numpy record type used on the python side
+struct ProgressSample {
+    double time;
+    double det_time;
+    double best_bound;
+    double incumbent;
+    double gap;
+    long nodes;
+};
+
+class ProgressMonitor {
+public:
+    ProgressMonitor(long capacity, bool copy_incumbent)
+	: _head(0), _tail(0), _dropped(0),
+	  _copy_incumbent(copy_incumbent), _has_incumbent(false), _incumbent_objective(0)
+	{
+	    long size = 1;
+	    while(size < capacity)
+		size *= 2;
+
+	    _buffer.resize(size);
+	    _mask = size - 1;
+
+	    // A slot is free for the push at position p when its sequence
+	    // is p, and holds that push's sample when it is p + 1.
+	    for(long i = 0; i < size; ++i)
+		_buffer[i].sequence = i;
+
+	    pthread_mutex_init(&_incumbent_lock, NULL);
+	}
+
+    ~ProgressMonitor()
+	{
+	    pthread_mutex_destroy(&_incumbent_lock);
+	}
+
+    // Called from the solver's threads
+    void push(const ProgressSample& s)
+	{
+	    long head = _head;
+	    Slot* slot;
+
+	    for(;;) {
+		slot = &_buffer[head & _mask];
+		long diff = slot->sequence - head;
+
+		if(diff == 0) {
+		    long seen = __sync_val_compare_and_swap(&_head, head, head + 1);
+
+		    if(seen == head)
+			break;
+
+		    head = seen;
+		} else if(diff < 0) {
+		    // Not read yet since the last time round
+		    __sync_fetch_and_add(&_dropped, 1);
+		    return;
+		} else {
+		    head = _head;
+		}
+	    }
+
+	    slot->sample = s;
+	    __sync_synchronize();
+	    slot->sequence = head + 1;
+	}
+
+    // Called from python; there should be only one reader at a time.
+    long pop(ProgressSample* dest, long max_samples)
+	{
+	    long tail = _tail;
+	    long n = 0;
+
+	    // Stops at the first slot that is reserved but not yet written
+	    while(n < max_samples) {
+		Slot& slot = _buffer[tail & _mask];
+
+		if(slot.sequence != tail + 1)
+		    break;
+
+		__sync_synchronize();
+		dest[n++] = slot.sample;
+		__sync_synchronize();
+
+		slot.sequence = tail + _mask + 1;
+		++tail;
+	    }
+
+	    _tail = tail;
+
+	    return n;
+	}
+
+    // May count samples that are still being written
+    long available() const { return _head - _tail; }
+
+    long dropped() const { return _dropped; }
+
+    bool copyIncumbent() const { return _copy_incumbent; }
+
+    void setIncumbent(const IloNumArray& values, double objective)
+	{
+	    pthread_mutex_lock(&_incumbent_lock);
+
+	    _incumbent.resize(values.getSize());
+
+	    for(long i = 0; i < values.getSize(); ++i)
+		_incumbent[i] = values[i];
+
+	    _incumbent_objective = objective;
+	    _has_incumbent = true;
+
+	    pthread_mutex_unlock(&_incumbent_lock);
+	}
+
+    // Copies up to n values; returns the number of values in the
+    // incumbent, or -1 if there is none.
+    long getIncumbent(double* dest, long n, double* objective)
+	{
+	    pthread_mutex_lock(&_incumbent_lock);
+
+	    long size = _has_incumbent ? long(_incumbent.size()) : -1;
+
+	    for(long i = 0; i < n && i < size; ++i)
+		dest[i] = _incumbent[i];
+
+	    *objective = _incumbent_objective;
+
+	    pthread_mutex_unlock(&_incumbent_lock);
+
+	    return size;
+	}
+
+private:
+    struct Slot {
+	volatile long sequence;
+	ProgressSample sample;
+    };
+
+    vector<Slot> _buffer;
+    long _mask;
+
+    volatile long _head;
+    volatile long _tail;
+    volatile long _dropped;
+
+    const bool _copy_incumbent;
+
+    pthread_mutex_t _incumbent_lock;
+    bool _has_incumbent;
+    double _incumbent_objective;
+    vector<double> _incumbent;
+};
+
+class ProgressCallbackI : public IloCplex::MIPInfoCallbackI {
+public:
+    ProgressCallbackI(IloEnv env, ProgressMonitor* monitor, const IloNumVarArray& vars)
+	: IloCplex::MIPInfoCallbackI(env), _monitor(monitor), _vars(vars),
+	  _values(env, vars.getSize()), _last_incumbent(IloInfinity)
+	{
+	}
+
+    ~ProgressCallbackI()
+	{
+	    _values.end();
+	}
+
+    // Each copy gets its own buffer for the incumbent values
+    IloCplex::CallbackI* duplicateCallback() const
+	{
+	    return new (getEnv()) ProgressCallbackI(getEnv(), _monitor, _vars);
+	}
+
+    void main()
+	{
+	    ProgressSample s;
+
+	    bool has_incumbent = hasIncumbent();
+
+	    s.time       = getCplexTime() - getStartTime();
+	    s.det_time   = getDetTime() - getStartDetTime();
+	    s.best_bound = getBestObjValue();
+	    s.incumbent  = has_incumbent ? getIncumbentObjValue() : IloNan;
+	    s.gap        = has_incumbent ? getMIPRelativeGap() : IloNan;
+	    s.nodes      = getNnodes64();
+
+	    _monitor->push(s);
+
+	    if(has_incumbent && _monitor->copyIncumbent() && s.incumbent != _last_incumbent) {
+		getIncumbentValues(_values, _vars);
+		_monitor->setIncumbent(_values, s.incumbent);
+		_last_incumbent = s.incumbent;
+	    }
+	}
+
+private:
+    ProgressMonitor* _monitor;
+    IloNumVarArray _vars;
+    IloNumArray _values;
+    double _last_incumbent;
+};
+
+#endif /* _PROGRESS_HPP_ */
@@ -2,14 +2,21 @@ from numpy cimport ndarray as ar, \
     int_t, uint_t, int32_t, uint32_t, int64_t, uint64_t, float_t
 
 cimport cython
+from libc.string cimport memcpy
 
 from numpy import int_, int32,uint32,int64, uint64, float32, float64,\
     uint, empty, ones, zeros, uint, arange, isscalar, amax, amin, \
-    ndarray, array, asarray, isfinite, argsort, matrix, nan, inf, float_
+    ndarray, array, asarray, isfinite, argsort, matrix, nan, inf, float_, dtype
 
 import numpy.random as rn
-import tempfile
-import os
+import threading
+import sys
+import time
+
+try:
+    from concurrent.futures import Future as _FutureBase
+except ImportError:
+    _FutureBase = object
 
 cdef object issparse
 
@@ -23,7 +30,7 @@ except ImportError:
 # The following defines the external definitions from the cplex
 # concert wrapper
 
-cdef extern from "cplex_interface.hpp":
+cdef extern from "cplex_interface.hpp" nogil:
 
     # The Ilo stuff we actually do need.  Most of it is handled using the templated wrappers
     cdef double IloInfinity
@@ -40,6 +47,35 @@ cdef extern from "cplex_interface.hpp":
         void setError(ostream&)
         ostream getNullStream()
 
+    cdef int PHASE_BUILD, PHASE_CONSTRAIN, PHASE_EXTRACT, PHASE_SOLVE, PHASE_RETRIEVE
+
+    cdef struct PhaseStats:
+        long long calls
+        long long wall_ns
+        long long cpu_ns
+
+    cdef struct ModelStats:
+        PhaseStats phases[5]
+        long long expressions_created
+        long long terms_emitted
+        long long constraints_added
+        long long iterations
+        long long queue_wait_ns
+        double det_ticks
+
+    # Reference counted environment owned by each model; converts
+    # implicitly to IloEnv on the C++ side.
+    cdef cppclass ModelEnv:
+        ModelEnv()
+        ModelEnv(ModelEnv)
+        bint sameAs(ModelEnv)
+        void setVerbosity(int)
+        long getMemoryUsage()
+        void copyStats(ModelStats*)
+        void resetStats()
+        void lock()
+        void unlock()
+
     cdef cppclass IloObjective:
         pass
 
@@ -48,7 +84,7 @@ cdef extern from "cplex_interface.hpp":
         IloObjective asObjective()
 
     cdef cppclass IloExprArray:
-        IloExprArray(IloEnv env, long n)
+        IloExprArray(ModelEnv env, long n)
         IloExpr& operator[](long i)
 
     cdef enum NumType "IloNumVar::Type":
@@ -57,15 +93,16 @@ cdef extern from "cplex_interface.hpp":
         Bool  "IloNumVar::Bool"
 
     cdef cppclass IloNumArray:
-        IloNumArray(IloEnv env, long)
+        IloNumArray(ModelEnv env, long)
         double& operator[](long)
+        void end()
 
     cdef cppclass IloNumVar(IloExpr):
         void setName(char *)
 
     # We'll work with the type constraint to implement integer or boolean constraints
     cdef cppclass IloNumVarArray:
-        IloNumVarArray(IloEnv env, IloNumArray lb, IloNumArray ub, NumType type)
+        IloNumVarArray(ModelEnv env, IloNumArray lb, IloNumArray ub, NumType type)
         IloNumVar& operator[](long i)
 
     # Now parts of the array functions that we use for working with
@@ -80,7 +117,9 @@ cdef extern from "cplex_interface.hpp":
     int OP_U_NO_TRANSLATE, OP_U_NEGATIVE, OP_U_ABS
     int OP_R_SUM, OP_R_MAX, OP_R_MIN
 
-    int MODEL_UNBOUNDED, MODEL_INFEASABLE, MODEL_UNBOUNDED_OR_INFEASABLE
+    int MODEL_UNBOUNDED, MODEL_INFEASABLE, MODEL_UNBOUNDED_OR_INFEASABLE, MODEL_ABORTED
+    int MODEL_LIMIT_REACHED
+    int CONSTRAINT_MODEL, CONSTRAINT_LAZY, CONSTRAINT_USER_CUT
 
     cdef cppclass MetaData:
         MetaData()
@@ -110,8 +149,8 @@ cdef extern from "cplex_interface.hpp":
         SliceSingle(long index)
 
     cdef cppclass ExpressionArray:
-        ExpressionArray(IloEnv, MetaData)
-        ExpressionArray(IloEnv, IloNumVarArray*, MetaData)
+        ExpressionArray(ModelEnv, MetaData)
+        ExpressionArray(ModelEnv, IloNumVarArray, MetaData)
         ExpressionArray(ExpressionArray, MetaData)
         void set(long, long, IloNumVar)
         IloNumVar get(long, long)
@@ -131,38 +170,50 @@ cdef extern from "cplex_interface.hpp":
         ExpressionArray* newAsMatrix()
 
         void setVariables(IloNumVarArray*)
+        void borrowFrom(ExpressionArray)
         
         MetaData md()
 
     cdef cppclass ConstraintArray:
-        ConstraintArray(IloEnv, MetaData)
+        ConstraintArray(ModelEnv, MetaData)
         MetaData md()
+
+    # Blocks to add in one call; see CPlexModel.constrain
+    cdef cppclass ConstraintPointers "std::vector<const ConstraintArray*>":
+        void push_back(ConstraintArray*)
+        size_t size()
+        void clear()
         
     cdef cppclass NumericalArray:
-        NumericalArray(IloEnv, double*, MetaData)
+        NumericalArray(ModelEnv, double*, MetaData)
         MetaData md()
         
     cdef cppclass Scalar: 
-        Scalar(IloEnv, double, MetaData)
-        Scalar(IloEnv, double)
+        Scalar(ModelEnv, double, MetaData)
+        Scalar(ModelEnv, double)
         MetaData md()
 
     ExpressionArray* newFromUnaryOp(ExpressionArray, int)
     ExpressionArray* newFromReduction(ExpressionArray, int op_type, int axis)
 
-    void binary_op(int op, ConstraintArray&, NumericalArray, ExpressionArray)
-    void binary_op(int op, ConstraintArray&, ExpressionArray, NumericalArray)
-    void binary_op(int op, ConstraintArray&, Scalar, ExpressionArray)
-    void binary_op(int op, ConstraintArray&, ExpressionArray, Scalar)
-    void binary_op(int op, ConstraintArray&, ExpressionArray, ExpressionArray)
-
-    void binary_op(int op, ExpressionArray&, NumericalArray, ExpressionArray)
-    void binary_op(int op, ExpressionArray&, ExpressionArray, NumericalArray)
-    void binary_op(int op, ExpressionArray&, Scalar, ExpressionArray)
-    void binary_op(int op, ExpressionArray&, ExpressionArray, Scalar)
-    void binary_op(int op, ExpressionArray&, ExpressionArray, ExpressionArray)
-    
-    void binary_op(int op, ConstraintArray&, ConstraintArray, ConstraintArray)
+    # These allocate the destination and fill it under the environment
+    # lock, so they are safe to call without the GIL.
+    ConstraintArray* newConstraintFromBinaryOp(int op, MetaData, NumericalArray, ExpressionArray)
+    ConstraintArray* newConstraintFromBinaryOp(int op, MetaData, ExpressionArray, NumericalArray)
+    ConstraintArray* newConstraintFromBinaryOp(int op, MetaData, Scalar, ExpressionArray)
+    ConstraintArray* newConstraintFromBinaryOp(int op, MetaData, ExpressionArray, Scalar)
+    ConstraintArray* newConstraintFromBinaryOp(int op, MetaData, ExpressionArray, ExpressionArray)
+
+    ExpressionArray* newFromBinaryOp(int op, MetaData, NumericalArray, ExpressionArray)
+    ExpressionArray* newFromBinaryOp(int op, MetaData, ExpressionArray, NumericalArray)
+    ExpressionArray* newFromBinaryOp(int op, MetaData, Scalar, ExpressionArray)
+    ExpressionArray* newFromBinaryOp(int op, MetaData, ExpressionArray, Scalar)
+    ExpressionArray* newFromBinaryOp(int op, MetaData, ExpressionArray, ExpressionArray)
+
+    int VAR_NAME_SCALAR, VAR_NAME_ARRAY, VAR_NAME_MATRIX
+
+    ExpressionArray* newVariableExpression(
+        ModelEnv, double* lb, double* ub, long, long, NumType, char* name, int name_mode)
 
     cdef struct Status "CPlexModelInterface::Status":
         int error_code 
@@ -181,33 +232,135 @@ cdef extern from "cplex_interface.hpp":
 
     cdef int CPX_ALG_NONE, CPX_ALG_AUTOMATIC, CPX_ALG_PRIMAL, CPX_ALG_DUAL, CPX_ALG_BARRIER,
     cdef int CPX_ALG_SIFTING, CPX_ALG_CONCURRENT, CPX_ALG_NET
+
+    cdef int PARAM_UNKNOWN, PARAM_INT, PARAM_LONG, PARAM_NUM, PARAM_BOOL, PARAM_STRING
+
+    int parameterKind(char* name)
+    long numParameters()
+    char* parameterName(long i)
+
+    cdef int MIPStartAuto "IloCplex::MIPStartAuto"
+    cdef int MIPStartCheckFeas "IloCplex::MIPStartCheckFeas"
+    cdef int MIPStartSolveFixed "IloCplex::MIPStartSolveFixed"
+    cdef int MIPStartSolveMIP "IloCplex::MIPStartSolveMIP"
+    cdef int MIPStartRepair "IloCplex::MIPStartRepair"
         
+    cdef struct ProgressSample:
+        double time
+        double det_time
+        double best_bound
+        double incumbent
+        double gap
+        long nodes
+
+    int SOLVE_NONE, SOLVE_OPTIMAL, SOLVE_FEASIBLE, SOLVE_LIMIT_REACHED
+    int SOLVE_INFEASIBLE, SOLVE_UNBOUNDED, SOLVE_INFEASIBLE_OR_UNBOUNDED
+    int SOLVE_ABORTED, SOLVE_ERROR
+
+    cdef struct SolveInfo:
+        int outcome
+        int cplex_status
+        double objective
+        double best_bound
+        double gap
+        long nodes
+        long threads
+        double queue_wait
+
+    cdef struct ThreadBudgetState:
+        long total
+        long default_request
+        long in_use
+        long queued
+        long long solves
+        double wait_seconds
+
+    void _setThreadBudget "setThreadBudget" (long total, long default_request)
+    void getThreadBudgetState(ThreadBudgetState*)
+
+    cdef cppclass LazySeparatorI:
+        bint addConstraints(ConstraintArray&, string* error)
+
+    ctypedef int (*SeparateFunction)(void* handler, double* values, long n,
+                                     LazySeparatorI* separator)
+
+    cdef cppclass SolveAborter:
+        SolveAborter()
+        void abort()
+        bint abortRequested()
+
     cdef cppclass CPlexModelInterface:
-        CPlexModelInterface(IloEnv)
+        CPlexModelInterface(ModelEnv)
         Status addVariables(ExpressionArray)
         Status addConstraint(ConstraintArray)
+        Status addConstraint(ConstraintArray, int pool)
+        Status addConstraints(ConstraintPointers&, int pool)
         Status removeConstraint(ConstraintArray)
+        Status removeConstraints(ConstraintPointers&)
         Status setObjective(ExpressionArray, bint)
         Status solve()
         Status solve(double*)
+        Status solve(double*, SolveAborter*)
         Status setParameter(IntParam, int value)
         Status setParameter(IntParam, double value)
+        Status setNamedParameter(char* name, double value)
+        Status setStringParameter(char* name, char* value)
+        Status getNamedParameter(char* name, double* value)
+        Status getStringParameter(char* name, string* value)
+        Status readParameters(char* filename)
+        Status writeParameters(char* filename)
+        Status setDefaultParameters()
         Status getValues(NumericalArray&, ExpressionArray)
+        Status getDuals(NumericalArray&, ConstraintArray)
+        Status getSlacks(NumericalArray&, ConstraintArray)
+        Status getReducedCosts(NumericalArray&, ExpressionArray)
         Status setStartingValues(ExpressionArray&, NumericalArray&)
+        Status updateRHS(ConstraintArray&, NumericalArray&)
+        Status setObjectiveCoefs(ExpressionArray&, NumericalArray&)
+        Status solveBatch(long n, ExpressionArray* cost_vars, double* costs,
+                          ConstraintArray* cstr, double* rhs, ExpressionArray* value_vars,
+                          double* objective_values, double* values)
+        Status updateBounds(ExpressionArray&, NumericalArray*, NumericalArray*)
+        Status recycleSolution()
+        Status addMIPStartValues(ExpressionArray&, NumericalArray&)
+        Status commitMIPStart(int effort)
+        void discardMIPStart()
+        Status clearMIPStarts()
         Status readBasis(char *filename)
         Status writeBasis(char *filename)
+        Status getBasis(int* var_status, long n_vars, int* cstr_status, long n_cstr)
+        Status setBasis(int* var_status, long n_vars, int* cstr_status, long n_cstr)
+        long getNumVariables()
+        long getNumConstraints()
+        Status clone(CPlexModelInterface** dest)
+        Status exportModel(char* filename)
+        Status importModel(char* filename)
+        long numImportedBlocks()
+        ExpressionArray* importedBlock(long i, string* name, int* name_mode)
+        ExpressionArray* importedObjective()
+        bint importedObjectiveMaximizes()
+        void setProgressMonitor(long capacity, bint copy_incumbent)
+        bint progressEnabled()
+        long progressAvailable()
+        long progressDropped()
+        long getProgress(ProgressSample* dest, long max_samples)
+        long getIncumbent(double* dest, long n, double* objective)
         bint solved()
         string asString()
         double getObjectiveValue()
+        void getSolveInfo(SolveInfo*)
         long getNIterations()
-
-    cdef Status newCPlexModelInterface(CPlexModelInterface**, IloEnv)
-
-# Set up the environment
-cdef IloEnv env = IloEnv() 
-
-#Check if this is valid or not; if not, raise an import error.
-# TODO....
+        Status populate(double*)
+        long getNumPoolSolutions()
+        long numLazyConstraints()
+        void setLazySeparator(SeparateFunction, void* handler)
+        Status addSeparatedVariables(ExpressionArray&)
+        long numUserCuts()
+        Status getPoolObjectives(double* dest, long n_solutions)
+        Status getPoolValues(double* dest, long n_solutions, ExpressionArray&)
+        long getMemoryUsage()
+
+    cdef Status newCPlexModelInterface(CPlexModelInterface**, ModelEnv)
 
 cdef str s_scalar = "scalar"
 
@@ -222,6 +375,7 @@ cdef str s_scalar = "scalar"
 cdef class CPlexModel
 cdef class CPlexExpression
 cdef class NumericalArrayWrapper
+cdef class _SolveAborter
 
 class CPlexException(Exception):
     """
@@ -246,7 +400,8 @@ class CPlexInitError(CPlexException):
 
 class CPlexNoSolution(CPlexException):
     """
-    Exception raised if the model is unbounded or infeasible.
+    Exception raised if the model is unbounded or infeasible, or if a
+    limit was reached before any solution was found.
     """
 
     pass
@@ -281,13 +436,20 @@ cdef inline CPlexExpression newCPEFromExisting(CPlexModel model, ExpressionArray
     return expr
 
 cdef inline CPlexExpression newCPE(CPlexModel model, MetaData md):
-    return newCPEFromExisting(model, new ExpressionArray(env, md))
+    cdef ExpressionArray *data
+
+    # Allocating takes the environment lock, which a solve may hold
+    # while its callbacks wait for the GIL; wait for it without.
+    with nogil:
+        data = new ExpressionArray(model.env[0], md)
+
+    return newCPEFromExisting(model, data)
 
 cdef inline CPlexExpression newCPEAsView(CPlexExpression cpx, MetaData md):
     return newCPEFromExisting(cpx.model, new ExpressionArray(cpx.data[0], cpx.data.md()))
 
-cdef inline CPlexExpression newCPEwithVariables(CPlexModel model, MetaData md, IloNumVarArray* v):
-    cdef CPlexExpression expr = newCPEFromExisting(model, new ExpressionArray(env, v, md))
+cdef inline CPlexExpression newCPEwithVariables(CPlexModel model, ExpressionArray* data):
+    cdef CPlexExpression expr = newCPEFromExisting(model, data)
     expr.is_simple  = True
     return  expr
     
@@ -332,7 +494,7 @@ cdef inline MetaData metadataFromNDArray(ar X, bint is_matrix):
                     1 if X.ndim == 1 else (<long>X.strides[1])/itemsize)
 
 
-cdef NumericalArrayWrapper newCoercedNumericalArray(Xo, MetaData md):
+cdef NumericalArrayWrapper newCoercedNumericalArray(CPlexModel model, Xo, MetaData md):
     # Attempts to return a NumericalArray, checking it against MetaData md 
 
     if type(Xo) is list:
@@ -360,7 +522,7 @@ cdef NumericalArrayWrapper newCoercedNumericalArray(Xo, MetaData md):
             raise IndexError("Incompatible array indices (%d, %d), needs (%d, %d)."
                              % (Xmd.shape(0), Xmd.shape(1), md.shape(0), md.shape(1)))
     
-    cdef NumericalArray *Xna = new NumericalArray(env, (<double*>(X.data)), Xmd)
+    cdef NumericalArray *Xna = new NumericalArray(model.env[0], (<double*>(X.data)), Xmd)
 
     return newNAW(Xna, X)
 
@@ -382,8 +544,7 @@ cdef dict _op_type_strings = {
 cdef str opTypeStrings(int op_code):
     return _op_type_strings[op_code & OP_SIMPLE_MASK]
 
-cdef CPlexExpression newEmptyExpression(
-    int op_type, CPlexModel model, MetaData md1, MetaData md2):
+cdef MetaData newExpressionMetaData(int op_type, MetaData md1, MetaData md2) except *:
 
     cdef bint okay = False
     cdef MetaData md_dest = newMetadata(op_type, md1, md2, &okay)
@@ -399,7 +560,7 @@ cdef CPlexExpression newEmptyExpression(
                              % (opTypeStrings(op_type),
                                 md1.shape(0), md1.shape(1), md2.shape(0), md2.shape(1)))
 
-    return newCPE(model, md_dest)
+    return md_dest
 
 ################################################################################
 # Now classes for expression interaction, constraint arrays, etc.
@@ -410,11 +571,13 @@ cdef inline CPlexExpression expression_op_expression(
     if expr1.model is not expr2.model:
         raise ValueError("Cannot combine expressions from two different models.")
 
-    cdef CPlexExpression dest = newEmptyExpression(op_type, expr1.model, expr1.data.md(), expr2.data.md())
+    cdef MetaData md_dest = newExpressionMetaData(op_type, expr1.data.md(), expr2.data.md())
+    cdef ExpressionArray *dest
 
-    binary_op(op_type, dest.data[0], expr1.data[0], expr2.data[0])
+    with nogil:
+        dest = newFromBinaryOp(op_type, md_dest, expr1.data[0], expr2.data[0])
 
-    return dest
+    return newCPEFromExisting(expr1.model, dest)
 
 
 cdef inline CPlexExpression expression_op_array(
@@ -430,80 +593,106 @@ cdef inline CPlexExpression expression_op_array(
     # See if we need to do an upcast
     cdef MetaData Xmd = metadataFromNDArray(X, type(Xo) is matrix)
     cdef MetaData Xmdt
-    cdef NumericalArray *Xna = new NumericalArray(env, (<double*>(X.data)), Xmd)
-
-    cdef CPlexExpression dest
+    cdef MetaData md_dest
+    cdef NumericalArray *Xna
+    cdef ExpressionArray *dest
 
     # First see if we can make it a "simple" type
     cdef bint matrix_multiplication = False
-    cdef bint is_simple 
+    cdef int full_op_type
 
-    try:
+    if reverse:
+        try:
+            md_dest = newExpressionMetaData(op_type, Xmd, expr.data.md())
+        except ValueError, ve:
+            if X.ndim == 1:
+                try:
+                    Xmd = Xmd.transposed()
+                    md_dest = newExpressionMetaData(op_type, Xmd, expr.data.md())
+                except ValueError:
+                    raise ve
+            else:
+                raise
+
+        matrix_multiplication = Xmd.matrix_multiplication_applies(expr.data.md())
+    else:
+        try:
+            md_dest = newExpressionMetaData(op_type, expr.data.md(), Xmd)
+        except ValueError, ve:
+            if X.ndim == 1:
+                try:
+                    Xmd = Xmd.transposed()
+                    md_dest = newExpressionMetaData(op_type, expr.data.md(), Xmd)
+                except ValueError:
+                    raise ve
+            else:
+                raise
+
+        matrix_multiplication = expr.data.md().matrix_multiplication_applies(Xmd)
+
+    full_op_type = op_type | (OP_SIMPLE_FLAG if (expr.is_simple or not matrix_multiplication) else 0)
+
+    Xna = new NumericalArray(expr.model.env[0], (<double*>(X.data)), Xmd)
+
+    with nogil:
         if reverse:
-            try:
-                dest = newEmptyExpression(op_type, expr.model, Xmd, expr.data.md())
-                matrix_multiplication = Xmd.matrix_multiplication_applies(expr.data.md())
-            except ValueError, ve:
-                if X.ndim == 1:
-                    try:
-                        Xmdt = Xmd.transposed()
-                        dest = newEmptyExpression(op_type, expr.model, Xmdt, expr.data.md())
-                        matrix_multiplication = Xmdt.matrix_multiplication_applies(expr.data.md())
-                    except ValueError:
-                        raise ve
-                else:
-                    raise
-                
-            is_simple = expr.is_simple or not matrix_multiplication
-            binary_op(op_type | (OP_SIMPLE_FLAG if is_simple else 0), dest.data[0], Xna[0], expr.data[0])
-                        
+            dest = newFromBinaryOp(full_op_type, md_dest, Xna[0], expr.data[0])
         else:
-            try:
-                dest = newEmptyExpression(op_type, expr.model, expr.data.md(), Xmd)
-                matrix_multiplication = expr.data.md().matrix_multiplication_applies(Xmd)
-            except ValueError, ve:
-                if X.ndim == 1:
-                    try:
-                        Xmdt = Xmd.transposed()
-                        dest = newEmptyExpression(op_type, expr.model, expr.data.md(), Xmdt)
-                        matrix_multiplication = expr.data.md().matrix_multiplication_applies(Xmdt)
-                    except ValueError:
-                        raise ve
-                else:
-                    raise
+            dest = newFromBinaryOp(full_op_type, md_dest, expr.data[0], Xna[0])
 
-            is_simple = expr.is_simple or not matrix_multiplication
-            binary_op(op_type | (OP_SIMPLE_FLAG if is_simple else 0), dest.data[0], expr.data[0], Xna[0])
-            
-    finally:
         del Xna
 
     # Need to determine when the simple flag can be propegated
-    dest.is_simple = (expr.is_simple and not matrix_multiplication)
+    cdef CPlexExpression cpx = newCPEFromExisting(expr.model, dest)
+    cpx.is_simple = (expr.is_simple and not matrix_multiplication)
     
-    return dest
+    return cpx
 
 cdef inline CPlexExpression expression_op_scalar(
     int op_type, CPlexExpression expr, double v, bint reverse):
     
-    cdef Scalar *sc = new Scalar(env, v)
-    cdef CPlexExpression dest
+    cdef Scalar *sc = new Scalar(expr.model.env[0], v)
+    cdef MetaData md_dest
+    cdef ExpressionArray *dest
 
     try:
         if reverse:
-            dest = newEmptyExpression(op_type, expr.model, sc.md(), expr.data.md())
-            binary_op(op_type | OP_SIMPLE_FLAG, dest.data[0], sc[0], expr.data[0])
+            md_dest = newExpressionMetaData(op_type, sc.md(), expr.data.md())
+        else:
+            md_dest = newExpressionMetaData(op_type, expr.data.md(), sc.md())
+    except:
+        del sc
+        raise
 
+    with nogil:
+        if reverse:
+            dest = newFromBinaryOp(op_type | OP_SIMPLE_FLAG, md_dest, sc[0], expr.data[0])
         else:
-            dest = newEmptyExpression(op_type, expr.model, expr.data.md(), sc.md())
-            binary_op(op_type | OP_SIMPLE_FLAG, dest.data[0], expr.data[0], sc[0])
-        
-    finally:
+            dest = newFromBinaryOp(op_type | OP_SIMPLE_FLAG, md_dest, expr.data[0], sc[0])
+
         del sc
-        
-    dest.is_simple = expr.is_simple
 
-    return dest
+    return newCPEFromCPEWithSameProperties(expr, dest)
+
+cdef inline CPlexExpression expression_unary_op(int op_type, CPlexExpression expr):
+
+    cdef ExpressionArray *dest
+
+    with nogil:
+        dest = newFromUnaryOp(expr.data[0], op_type)
+
+    return newCPEFromCPEWithSameProperties(expr, dest)
+
+cdef inline CPlexExpression expression_reduction(int op_type, CPlexExpression expr, axis):
+
+    cdef int full_op_type = op_type | (OP_SIMPLE_FLAG if expr.is_simple else 0)
+    cdef int reduction_axis = -1 if axis is None else axis
+    cdef ExpressionArray *dest
+
+    with nogil:
+        dest = newFromReduction(expr.data[0], full_op_type, reduction_axis)
+
+    return newCPEFromExisting(expr.model, dest)
 
 ############################################################
 # The main control function for expressions
@@ -594,6 +783,9 @@ cdef class CPlexExpression(object):
     def __init__(self):
         raise Exception("CPlexExpression not meant to be instantiated directly.")
 
+    def __dealloc__(self):
+        del self.data
+
     def __add__(self, v):
         return expr_var_op_var(OP_B_ADD, self, v)
 
@@ -713,7 +905,7 @@ cdef class CPlexExpression(object):
         return newCPEFromCPEWithSameProperties(self, self.data.newAsMatrix())
 
     def __neg__(self):
-        return newCPEFromCPEWithSameProperties(self, newFromUnaryOp(self.data[0], OP_U_NEGATIVE))
+        return expression_unary_op(OP_U_NEGATIVE, self)
 
     @property
     def shape(self):
@@ -836,10 +1028,7 @@ cdef class CPlexExpression(object):
           print m[X.sum(axis = 0)]
 
         """
-        return newCPEFromExisting(self.model, newFromReduction(
-            self.data[0],
-            OP_R_SUM | (OP_SIMPLE_FLAG if self.is_simple else 0),
-            -1 if axis is None else axis))
+        return expression_reduction(OP_R_SUM, self, axis)
 
     def mean(self, axis = None):
         """
@@ -888,10 +1077,7 @@ cdef class CPlexExpression(object):
           print m[X.max(axis = 0)]
 
         """
-        return newCPEFromExisting(self.model, newFromReduction(
-            self.data[0],
-            OP_R_MAX | (OP_SIMPLE_FLAG if self.is_simple else 0),
-            -1 if axis is None else axis))
+        return expression_reduction(OP_R_MAX, self, axis)
 
     def min(self, axis = None):
         """
@@ -912,13 +1098,10 @@ cdef class CPlexExpression(object):
           print m[X.min(axis = 0)]
 
         """
-        return newCPEFromExisting(self.model, newFromReduction(
-            self.data[0],
-            OP_R_MIN | (OP_SIMPLE_FLAG if self.is_simple else 0),
-            -1 if axis is None else axis))
+        return expression_reduction(OP_R_MIN, self, axis)
 
     def __abs__(self):
-        return newCPEFromCPEWithSameProperties(self, newFromUnaryOp(self.data[0], OP_U_ABS))
+        return expression_unary_op(OP_U_ABS, self)
 
     def abs(self):
         """
@@ -936,7 +1119,7 @@ cdef class CPlexExpression(object):
         Returns a copy of the current expression.
         """
         
-        return newCPEFromCPEWithSameProperties(self, newFromUnaryOp(self.data[0], OP_U_NO_TRANSLATE))
+        return expression_unary_op(OP_U_NO_TRANSLATE, self)
 
     def __len__(self):
         return self.data.md().size()
@@ -1075,24 +1258,24 @@ cdef CPlexExpression newVariableBlock(CPlexModel model, size, var_type, lower_bo
     ########################################
     # Now set the lower bounds
 
-    cdef IloNumArray *lb = new IloNumArray(env, n)
+    cdef ar[double, mode="c"] lb = empty(n, dtype=float_)
     cdef ar[int_t, mode="c"] finite_elements = None
 
     if lower_bound is None:
         for 0 <= i < n:
-            lb[0][i] = -IloInfinity
+            lb[i] = -IloInfinity
 
     elif isscalar(lower_bound):
         d = lower_bound
         for 0 <= i < n:
-            lb[0][i] = d
+            lb[i] = d
 
     else:
         dv_r = toDoubleArray_1d(lower_bound, "lower_bound", n)
 
         if dv_r is None:
             for 0 <= i < n:
-                lb[0][i] = -IloInfinity
+                lb[i] = -IloInfinity
         else:
             dv = dv_r
 
@@ -1100,28 +1283,28 @@ cdef CPlexExpression newVariableBlock(CPlexModel model, size, var_type, lower_bo
             isfinite(dv_r, finite_elements)
 
             for 0 <= i < n:
-                lb[0][i] = dv[i] if finite_elements[i] else -IloInfinity
+                lb[i] = dv[i] if finite_elements[i] else -IloInfinity
 
     ########################################
     # Now set the upper bounds
 
-    cdef IloNumArray *ub = new IloNumArray(env, n)
+    cdef ar[double, mode="c"] ub = empty(n, dtype=float_)
 
     if upper_bound is None:
         for 0 <= i < n:
-            ub[0][i] = IloInfinity
+            ub[i] = IloInfinity
 
     elif isscalar(upper_bound):
         d = upper_bound
         for 0 <= i < n:
-            ub[0][i] = d
+            ub[i] = d
 
     else:
         dv_r = toDoubleArray_1d(upper_bound, "upper_bound", n)
 
         if dv_r is None:
             for 0 <= i < n:
-                ub[0][i] = IloInfinity
+                ub[i] = IloInfinity
         else:
             dv = dv_r
 
@@ -1131,51 +1314,100 @@ cdef CPlexExpression newVariableBlock(CPlexModel model, size, var_type, lower_bo
             isfinite(dv_r, finite_elements)
 
             for 0 <= i < n:
-                ub[0][i] = dv[i] if finite_elements[i] else IloInfinity
+                ub[i] = dv[i] if finite_elements[i] else IloInfinity
 
 
-    ########################################
-    # Now get the variables
-    cdef IloNumVarArray* v = new IloNumVarArray(env, lb[0], ub[0], cpx_var_type)
-
-    del lb
-    del ub
-
     ############################################################
-    # Set names if applicable
+    # Set up the names if applicable
 
-    if name is not None:
+    cdef bytes name_b
+    cdef char* name_c = NULL
+    cdef int name_mode
 
-        if n == 1:
-            s = bytes(name)
-            v[0][0].setName(s)
+    if name is not None:
+        name_b = bytes(name)
+        name_c = name_b
 
-        elif var_mode == "array":
-            for 0 <= i < d_0:
-                for 0 <= j < d_1:
-                    s = bytes("%s[%d]" % (name, i*d_1 + j))
-                    v[0][i*d_1 + j].setName(s)
-        else:
-            for 0 <= i < d_0:
-                for 0 <= j < d_1:
-                    s = bytes("%s[%d,%d]" % (name, i,j))
-                    v[0][i*d_1 + j].setName(s)
+    if n == 1:
+        name_mode = VAR_NAME_SCALAR
+    elif var_mode == "array":
+        name_mode = VAR_NAME_ARRAY
+    else:
+        name_mode = VAR_NAME_MATRIX
 
     ############################################################
-    # Now initialize the base class with an expression consisting
-    # of the new variable set.
+    # Now create the variables and initialize the base class with an
+    # expression consisting of the new variable set.
+
+    cdef ExpressionArray *v
 
-    cdef CPlexExpression cpx = newCPEwithVariables(model, MetaData(MATRIX_MODE, d_0, d_1), v)
+    with nogil:
+        v = newVariableExpression(model.env[0], <double*>lb.data, <double*>ub.data,
+                                  d_0, d_1, cpx_var_type, name_c, name_mode)
 
-    for 0 <= i < d_0:
-        for 0 <= j < d_1:
-            cpx.data.set(i, j, v[0][i*d_1 + j])
+    cdef CPlexExpression cpx = newCPEwithVariables(model, v)
 
     cpx.original_size = size
     cpx.key = key
 
     return cpx
 
+def setThreadBudget(threads, long threads_per_solve = 1):
+    """
+    Shares a budget of `threads` solver threads among all models in
+    the process, so that concurrent solves do not oversubscribe the
+    machine.  Each solve then asks for as many threads as its
+    ``Threads`` parameter (or the `max_threads` option of
+    :meth:`CPlexModel.solve`) gives, or `threads_per_solve` if that
+    is 0, the default.  It gets that many, or what is left of the
+    budget if that is less.  When the budget is used up, solves wait
+    in line and start in the order they were made as other solves
+    finish; the wait is reported by :meth:`CPlexModel.getSolveInfo`
+    and :meth:`CPlexModel.stats`.
+
+    Passing None or 0 for `threads` turns the budget off, letting
+    every solve use its own ``Threads`` setting right away.
+
+    Example::
+
+      >>> import multiprocessing
+      >>> setThreadBudget(multiprocessing.cpu_count(), threads_per_solve = 4)
+    """
+
+    cdef long total = 0 if threads is None else threads
+
+    if total < 0:
+        raise ValueError("threads must not be negative.")
+
+    if threads_per_solve < 1:
+        raise ValueError("threads_per_solve must be at least 1.")
+
+    with nogil:
+        _setThreadBudget(total, threads_per_solve)
+
+def getThreadBudget():
+    """
+    Returns the state of the thread budget set by
+    :func:`setThreadBudget` as a dictionary holding the ``'threads'``
+    in the budget (0 if there is none), the ``'threads_per_solve'``,
+    the threads ``'in_use'`` by running solves, the number of solves
+    ``'queued'`` for threads, and the number of ``'solves'`` started
+    and the total seconds they spent waiting, ``'wait'``, under the
+    budget.
+    """
+
+    cdef ThreadBudgetState st
+
+    with nogil:
+        getThreadBudgetState(&st)
+
+    return {"threads"           : st.total,
+            "threads_per_solve" : st.default_request,
+            "in_use"            : st.in_use,
+            "queued"            : st.queued,
+            "solves"            : st.solves,
+            "wait"              : st.wait_seconds}
+
 def concatenate(list expression_list, int axis = 0):
     """
     Concatenates arrays along a particular axis.
@@ -1224,22 +1456,55 @@ def concatenate(list expression_list, int axis = 0):
     cdef CPlexExpression dest = newCPE(model, md)
 
     cdef long j, k
-    
-    for i, cpe in enumerate(expression_list):
-        pos_start, pos_end = breaks[i]
 
-        if axis == 0:
-            for j in range(0, pos_end - pos_start):
-                for k in range(0, same_axis_size):
-                    dest.data.set(pos_start + j, k, cpe.data.get(j,k))
-        else:
-            for j in range(0, same_axis_size):
-                for k in range(0, pos_end - pos_start):
-                    dest.data.set(j, pos_start + k, cpe.data.get(j,k))
+    # The copies below touch the environment, so hold its lock; wait
+    # for it without the GIL.
+    with nogil:
+        model.env.lock()
+
+    try:
+        for i, cpe in enumerate(expression_list):
+            pos_start, pos_end = breaks[i]
+
+            dest.data.borrowFrom(cpe.data[0])
+
+            if axis == 0:
+                for j in range(0, pos_end - pos_start):
+                    for k in range(0, same_axis_size):
+                        dest.data.set(pos_start + j, k, cpe.data.get(j,k))
+            else:
+                for j in range(0, same_axis_size):
+                    for k in range(0, pos_end - pos_start):
+                        dest.data.set(j, pos_start + k, cpe.data.get(j,k))
+    finally:
+        model.env.unlock()
 
     return dest
 
 
+cdef shapedLikeBlock(CPlexExpression v, M):
+    # Returns the values in M in the form the block v was requested in
+
+    size = v.original_size
+
+    if size == s_scalar:
+        assert M.shape[0] == M.shape[1] == 1
+        return M[0,0]
+
+    elif (type(size) is tuple and len(<tuple>size) == 2):
+        return M
+
+    elif (type(size) is tuple and len(<tuple>size) == 1):
+        assert M.shape[0] == size[0]
+        return asarray(M).ravel()
+
+    elif isscalar(size):
+        assert M.shape[0] == size and M.shape[1] == 1
+        return asarray(M).ravel()
+
+    else:
+        return M
+
 ################################################################################
 # Constraint creation functions
 
@@ -1268,12 +1533,12 @@ cdef class CPlexConstraint(object):
 cdef extern from "py_new_wrapper.h":
     CPlexConstraint createBlankCPlexConstraint "PY_NEW" (object t)
 
-cdef inline CPlexConstraint newCPC(CPlexModel model, MetaData md, left, right):
+cdef inline CPlexConstraint newCPC(CPlexModel model, ConstraintArray* data, left, right):
     
     cdef CPlexConstraint c = createBlankCPlexConstraint(CPlexConstraint)
     
     c.model               = model
-    c.data                = new ConstraintArray(env, md)
+    c.data                = data
     c.id_right            = id(right)
     c.id_left             = id(left)
 
@@ -1292,8 +1557,7 @@ cdef inline CPlexConstraint newCPC(CPlexModel model, MetaData md, left, right):
 
     return c
 
-cdef CPlexConstraint newEmptyConstraint(
-    int op_type, CPlexModel model, left, MetaData md1, right, MetaData md2):
+cdef MetaData newConstraintMetaData(int op_type, MetaData md1, MetaData md2) except *:
 
     cdef bint okay = False
     cdef MetaData md_dest = newMetadata(op_type, md1, md2, &okay)
@@ -1303,7 +1567,7 @@ cdef CPlexConstraint newEmptyConstraint(
                          % (opTypeStrings(op_type),
                             md1.shape(0), md1.shape(1), md2.shape(0), md2.shape(1)))
 
-    return newCPC(model, md_dest, left, right)
+    return md_dest
 
 
 ################################################################################
@@ -1315,12 +1579,13 @@ cdef CPlexConstraint cstr_expression_op_expression(
     if expr1.model is not expr2.model:
         raise ValueError("Cannot combine expressions from two different models.")
 
-    cdef CPlexConstraint dest = newEmptyConstraint(
-        op_type, expr1.model, expr1, expr1.data.md(), expr2, expr2.data.md())
+    cdef MetaData md_dest = newConstraintMetaData(op_type, expr1.data.md(), expr2.data.md())
+    cdef ConstraintArray *dest
 
-    binary_op(op_type, dest.data[0], expr1.data[0], expr2.data[0])
+    with nogil:
+        dest = newConstraintFromBinaryOp(op_type, md_dest, expr1.data[0], expr2.data[0])
 
-    return dest
+    return newCPC(expr1.model, dest, expr1, expr2)
 
 cdef CPlexConstraint cstr_expression_op_array(
     int op_type, CPlexExpression expr, Xo, bint reverse):
@@ -1340,68 +1605,78 @@ cdef CPlexConstraint cstr_expression_op_array(
                                  (<long>X.strides[0])/itemsize,
                                  1 if X.ndim == 1 else (<long>X.strides[1])/itemsize)
 
-    cdef NumericalArray *Xna = new NumericalArray(env, (<double*>(X.data)), Xmd)
+    cdef MetaData md_dest
+    cdef NumericalArray *Xna
+    cdef ConstraintArray *dest
 
-    cdef CPlexConstraint dest
+    if reverse:
+        try:
+            md_dest = newConstraintMetaData(op_type, Xmd, expr.data.md())
+        except ValueError, ve:
+            if X.ndim == 1:
+                try:
+                    Xmd = Xmd.transposed()
+                    md_dest = newConstraintMetaData(op_type, Xmd, expr.data.md())
+                except ValueError:
+                    raise ve
+            else:
+                raise
+    else:
+        try:
+            md_dest = newConstraintMetaData(op_type, expr.data.md(), Xmd)
+        except ValueError, ve:
+            if X.ndim == 1:
+                try:
+                    Xmd = Xmd.transposed()
+                    md_dest = newConstraintMetaData(op_type, expr.data.md(), Xmd)
+                except ValueError:
+                    raise ve
+            else:
+                raise
 
-    try:
+    Xna = new NumericalArray(expr.model.env[0], (<double*>(X.data)), Xmd)
 
+    with nogil:
         if reverse:
-            try:
-                dest = newEmptyConstraint(op_type, expr.model, Xo, Xmd, expr, expr.data.md())
-            except ValueError, ve:
-                if X.ndim == 1:
-                    try:
-                        dest = newEmptyConstraint(
-                            op_type, expr.model, Xo, Xmd.transposed(), expr, expr.data.md())
-                        
-                    except ValueError:
-                        raise ve
-                else:
-                    raise
-
-            binary_op(op_type | OP_SIMPLE_FLAG, dest.data[0], Xna[0], expr.data[0])
-
+            dest = newConstraintFromBinaryOp(op_type | OP_SIMPLE_FLAG, md_dest, Xna[0], expr.data[0])
         else:
-            try:
-                dest = newEmptyConstraint(
-                    op_type, expr.model, expr, expr.data.md(), Xo, Xmd)
-                
-            except ValueError, ve:
-                if X.ndim == 1:
-                    try:
-                        dest = newEmptyConstraint(
-                            op_type, expr.model, expr, expr.data.md(), Xo, Xmd.transposed())
-                        
-                    except ValueError:
-                        raise ve
-                else:
-                    raise
+            dest = newConstraintFromBinaryOp(op_type | OP_SIMPLE_FLAG, md_dest, expr.data[0], Xna[0])
 
-            binary_op(op_type | OP_SIMPLE_FLAG, dest.data[0], expr.data[0], Xna[0])
-    finally:
         del Xna
-        
-    return dest
+
+    if reverse:
+        return newCPC(expr.model, dest, Xo, expr)
+    else:
+        return newCPC(expr.model, dest, expr, Xo)
 
 cdef CPlexConstraint cstr_expression_op_scalar(
     int op_type, CPlexExpression expr, v, bint reverse):
 
-    cdef Scalar *sc = new Scalar(env, <double?>v)
-    cdef CPlexConstraint dest
+    cdef Scalar *sc = new Scalar(expr.model.env[0], <double?>v)
+    cdef MetaData md_dest
+    cdef ConstraintArray *dest
 
     try:
         if reverse:
-            dest = newEmptyConstraint(op_type, expr.model, v, sc.md(), expr, expr.data.md())
-            binary_op(op_type | OP_SIMPLE_FLAG, dest.data[0], sc[0], expr.data[0])
+            md_dest = newConstraintMetaData(op_type, sc.md(), expr.data.md())
+        else:
+            md_dest = newConstraintMetaData(op_type, expr.data.md(), sc.md())
+    except:
+        del sc
+        raise
 
+    with nogil:
+        if reverse:
+            dest = newConstraintFromBinaryOp(op_type | OP_SIMPLE_FLAG, md_dest, sc[0], expr.data[0])
         else:
-            dest = newEmptyConstraint(op_type, expr.model, expr, expr.data.md(), v, sc.md())
-            binary_op(op_type | OP_SIMPLE_FLAG, dest.data[0], expr.data[0], sc[0])
-    finally:
+            dest = newConstraintFromBinaryOp(op_type | OP_SIMPLE_FLAG, md_dest, expr.data[0], sc[0])
+
         del sc
 
-    return dest
+    if reverse:
+        return newCPC(expr.model, dest, v, expr)
+    else:
+        return newCPC(expr.model, dest, expr, v)
 
 ##################################################
 # The main constraint operator class
@@ -1443,6 +1718,45 @@ cdef CPlexConstraint cstr_var_op_var(op_type, a1, a2):
 ################################################################################
 # Now the model
 
+cdef _broadcastScalar(X, MetaData md):
+    # Scalars are expanded to the full shape of md; arrays are left
+    # to newCoercedNumericalArray to check.
+
+    if isscalar(X):
+        return X * ones( (md.shape(0), md.shape(1)) )
+    else:
+        return X
+
+cdef ar _boundArray(X, MetaData md, double unbounded):
+    # Bounds as passed to update_bounds, with NaNs meaning unbounded
+    # and infinities clipped to those of CPlex
+
+    cdef ar B = array(_broadcastScalar(X, md), dtype=float_, ndmin = 1)
+
+    B[B != B] = unbounded
+    B[B > IloInfinity] = IloInfinity
+    B[B < -IloInfinity] = -IloInfinity
+
+    return B
+
+cdef bint _objectiveSense(maximize, minimize) except *:
+    # True for maximizing, as given by the maximize and minimize
+    # options of solve
+
+    if maximize is not None and minimize is None:
+        return maximize
+            
+    elif maximize is None and minimize is not None:
+        return not minimize
+            
+    elif maximize is not None and minimize is not None:
+        if bool(maximize) == bool(minimize):
+            raise ValueError("Cannot both maximize and minimize the problem at the same time.")
+
+        return maximize
+
+    return True
+
 cdef dict model_lookup = {
     "auto"       : CPX_ALG_AUTOMATIC,
     "automatic"  : CPX_ALG_AUTOMATIC,
@@ -1454,19 +1768,66 @@ cdef dict model_lookup = {
     "net"        : CPX_ALG_NET,
     "netflow"    : CPX_ALG_NET }
            
+cdef dict solve_outcome_names = {
+    SOLVE_NONE                    : "none",
+    SOLVE_OPTIMAL                 : "optimal",
+    SOLVE_FEASIBLE                : "feasible",
+    SOLVE_LIMIT_REACHED           : "limit_reached",
+    SOLVE_INFEASIBLE              : "infeasible",
+    SOLVE_UNBOUNDED               : "unbounded",
+    SOLVE_INFEASIBLE_OR_UNBOUNDED : "infeasible_or_unbounded",
+    SOLVE_ABORTED                 : "aborted",
+    SOLVE_ERROR                   : "error" }
+
+cdef dict pool_replace_lookup = {
+    "oldest"     : 0,
+    "objective"  : 1,
+    "diversity"  : 2 }
+
+cdef dict mip_start_effort_lookup = {
+    "auto"       : MIPStartAuto,
+    "check"      : MIPStartCheckFeas,
+    "solve_fixed": MIPStartSolveFixed,
+    "solve_mip"  : MIPStartSolveMIP,
+    "repair"     : MIPStartRepair }
+
+# Matches ProgressSample in progress.hpp
+progress_dtype = dtype([("time",       float64),
+                        ("det_time",   float64),
+                        ("best_bound", float64),
+                        ("incumbent",  float64),
+                        ("gap",        float64),
+                        ("nodes",      int_)])
+
 cdef class CPlexModel(object):
 
     # THis is for the constraint stuff
     cdef size_t hook_id_1, hook_id_2
     cdef CPlexConstraint hooked_constraint
     cdef CPlexModelInterface *model
+    cdef ModelEnv *env
     cdef int verbosity
     cdef size_t rv_number
     cdef dict key_strings
     cdef list variables
     cdef double last_op_time 
-
-    def __cinit__(self, int verbosity = 2):
+    cdef SolveAborter *solve_control
+    cdef CPlexExpression imported_objective
+    cdef bint imported_maximize
+
+    # The lazy constraint callback; see setLazyConstraintCallback
+    cdef object lazy_function
+    cdef ar lazy_buffer
+    cdef tuple lazy_views
+    cdef object lazy_error
+
+    # Constraint changes held back by batch(), as a list of (pool,
+    # constraints) runs, with a pool of -1 for removals; None outside
+    # of a batch.
+    cdef list batch_ops
+    cdef int batch_depth
+
+    def __cinit__(self, int verbosity = 2, CPlexModel _clone_of = None):
         """
         Creates a new empty model.
 
@@ -1485,11 +1846,34 @@ cdef class CPlexModel(object):
         self.last_op_time = 0
 
         self.model = NULL
+        self.solve_control = NULL
+        self.imported_objective = None
+
+        self.batch_ops = None
+        self.batch_depth = 0
+
+        cdef Status model_status
+
+        # Clones share the environment of the model they come from
+        if _clone_of is not None:
+            self.verbosity = _clone_of.verbosity
+            self.env = new ModelEnv(_clone_of.env[0])
+
+            with nogil:
+                model_status = _clone_of.model.clone(&self.model)
+
+            if model_status.error_code != 0:
+                raise CPlexException("Error cloning model: %s" % str(model_status.message))
+
+            return
+
+        # Each model gets its own environment, so that everything
+        # allocated for it is released along with it.
+        self.env = new ModelEnv()
 
         self.setVerbosity(verbosity)
-        self._checkVerbosity()
 
-        cdef Status model_status = newCPlexModelInterface(&self.model, env)
+        model_status = newCPlexModelInterface(&self.model, self.env[0])
 
         if model_status.error_code != 0:
             raise CPlexInitError("Error initializing new cplex model: %s" % str(model_status.message))
@@ -1498,6 +1882,9 @@ cdef class CPlexModel(object):
         if self.model != NULL:
             del self.model
 
+        if self.env != NULL:
+            del self.env
+
     cpdef setVerbosity(self, int verbosity):
         """
         Sets the verbosity level of the solver.  The verbosity level
@@ -1517,6 +1904,7 @@ cdef class CPlexModel(object):
             raise ValueError("Verbosity must be 0, 1, 2, or 3.")
 
         self.verbosity = verbosity
+        self._checkVerbosity()
 
     cdef _checkOkay(self):
         if self.model == NULL:
@@ -1668,28 +2056,20 @@ cdef class CPlexModel(object):
         
         cdef CPlexExpression new_var = newVariableBlock(self, size, vtype, lb, ub, name, key)
         self.variables.append(new_var)
-        s = self.model.addVariables(new_var.data[0])        
+
+        cdef Status s
+
+        with nogil:
+            s = self.model.addVariables(new_var.data[0])
+
         return new_var
 
     cdef _checkVerbosity(self):
-        if self.verbosity == 0:
-            env.setError(env.getNullStream())
-            env.setWarning(env.getNullStream())
-            env.setOut(env.getNullStream())
-        elif self.verbosity == 1:
-            env.setError(cout)
-            env.setWarning(env.getNullStream())
-            env.setOut(env.getNullStream())
-        elif self.verbosity == 2:
-            env.setError(cout)
-            env.setWarning(cout)
-            env.setOut(env.getNullStream())
-        elif self.verbosity == 3:
-            env.setError(cerr)
-            env.setWarning(cerr)
-            env.setOut(cout)
-        else:
-            assert False
+        cdef int verbosity = self.verbosity
+
+        if self.env != NULL:
+            with nogil:
+                self.env.setVerbosity(verbosity)
 
     cdef _getKeyStringId(self, str key, MetaData md):
         # A mapping to keep things unique
@@ -1707,53 +2087,46 @@ cdef class CPlexModel(object):
             self.key_strings[query_key] = query_key
             return id(query_key)
 
-    cdef _checkConstraints(self, tuple constraints):
-
-        cdef size_t i
-        for i, c in enumerate(constraints):
-            if type(c) is list:
-                self._checkConstraints(tuple(c))
-                
-            elif type(c) is tuple:
-                self._checkConstraints(<tuple>c)
-            
-            elif type(c) is not CPlexConstraint:
-                raise TypeError("Expected constraint in argument %d, got %s."
-                                % (i + 1, repr(type(c))))
+    cdef _collectConstraints(self, constraints, ConstraintPointers* dest, list keep = None):
+        # Checks the constraints, possibly in nested lists and tuples,
+        # and puts them in dest, along with those hooked to them by
+        # chained comparisons, in the one pass.  If keep is given, the
+        # constraint objects are appended to it as well.
 
-            elif (<CPlexConstraint>c).model is not self:
-                raise CPlexException("Constraint %d not from this model." % (i + 1))
+        cdef CPlexConstraint c, c2
+        cdef long i = 0
 
-    cdef _addConstraint(self, CPlexConstraint c):
-        cdef Status s
-        s = self.model.addConstraint(c.data[0])
-        if s.error_code != 0:
-            raise CPlexException("Error adding constraint: %s" % s.message)
+        for ce in constraints:
+            i += 1
 
-    cdef _addConstraints(self, tuple constraints):
+            if type(ce) is CPlexConstraint:
+                c = <CPlexConstraint>ce
 
-        cdef CPlexConstraint c, c2
+                if c.model is not self:
+                    raise CPlexException("Constraint %d not from this model." % i)
 
-        for ce in constraints:
-            if type(ce) is tuple:
-                self._addConstraints(<tuple>ce)
-            elif type(ce) is list:
-                self._addConstraints(tuple(ce))
-            elif ce is True:
-                # to handle corner case of (x == x), which gets
-                # compared by id.
-                
-                continue
-            else:
-                c2 = c = ce
+                c2 = c
 
                 while c2.hooked_constraint is not None:
                     c2 = c2.hooked_constraint
-                    self._addConstraint(c2)
+                    dest.push_back(c2.data)
+
+                    if keep is not None:
+                        keep.append(c2)
+
+                dest.push_back(c.data)
+
+                if keep is not None:
+                    keep.append(c)
+
+            elif type(ce) is list or type(ce) is tuple:
+                self._collectConstraints(ce, dest, keep)
 
-                self._addConstraint(c)
+            else:
+                raise TypeError("Expected constraint in argument %d, got %s."
+                                % (i, repr(type(ce))))
 
-    def constrain(self, *constraints):
+    def constrain(self, *constraints, bint lazy = False, bint user_cut = False):
         """
         Add a constraint or set of constraints to the model.  
 
@@ -1829,44 +2202,79 @@ cdef class CPlexModel(object):
         is perfectly valid.  This can be useful if these constraints
         need to be removed from the model later on using
         :meth:`removeConstraint`.  
+
+
+        **Lazy Constraints and User Cuts**
+
+        Large families of constraints of which only a few are expected
+        to bind can be kept out of the model itself.  With
+        ``lazy=True``, the constraints go into CPlex's lazy constraint
+        pool: they are not part of the relaxation, and are only
+        checked against each candidate integer solution, being added
+        to the problem when that solution violates them.  With
+        ``user_cut=True``, they go into the user cut pool instead;
+        these must be implied by the rest of the model, and are only
+        used to tighten the relaxation.  For example::
+
+          m.constrain(A*x <= b, lazy = True)
+
+        Both pools are only used when solving mixed-integer problems,
+        and the constraints must be linear.  Pooled constraints can be
+        removed with :meth:`removeConstraint` as usual, but duals and
+        slacks are not available for them.
+
+        Within :meth:`batch`, the constraints are checked here but only
+        added to the model when the batch ends.
         """
 
         self._checkOkay()
 
-        # First check types
-        self._checkConstraints(constraints)
-        self._addConstraints(constraints)
+        if lazy and user_cut:
+            raise ValueError("A constraint can be either lazy or a user cut, not both.")
 
-    # Removing constraints if need be
+        cdef int pool = (CONSTRAINT_LAZY if lazy else
+                         (CONSTRAINT_USER_CUT if user_cut else CONSTRAINT_MODEL))
+
+        # Nothing is added unless all of them check out
+        cdef ConstraintPointers blocks
+        cdef list keep = [] if self.batch_ops is not None else None
+
+        self._collectConstraints(constraints, &blocks, keep)
+
+        if blocks.size() == 0:
+            return
+
+        if keep is not None:
+            self._deferConstraints(pool, keep)
+            return
 
-    cdef _removeConstraint(self, CPlexConstraint c):
         cdef Status s
-        s = self.model.removeConstraint(c.data[0])
+
+        with nogil:
+            s = self.model.addConstraints(blocks, pool)
+
         if s.error_code != 0:
-            raise CPlexException("Error removing constraint: %s" % s.message)
- 
-    cdef _removeConstraints(self, tuple constraints):
+            raise CPlexException("Error adding constraint: %s" % s.message)
 
-        cdef CPlexConstraint c, c2
+    def getNumLazyConstraints(self):
+        """
+        Returns the number of constraints in the lazy constraint pool;
+        see :meth:`constrain`.
+        """
 
-        for ce in constraints:
-            if type(ce) is list:
-                self._addConstraints(tuple(ce))
-            if type(ce) is tuple:
-                self._addConstraints(<tuple>ce)
-            elif ce is True:
-                # to handle corner case of (x == x), which gets
-                # compared by id.
-                
-                continue
-            else:
-                c2 = c = ce
+        self._checkOkay()
+        return self.model.numLazyConstraints()
 
-                while c2.hooked_constraint is not None:
-                    c2 = c2.hooked_constraint
-                    self._removeConstraint(c2)
+    def getNumUserCuts(self):
+        """
+        Returns the number of constraints in the user cut pool; see
+        :meth:`constrain`.
+        """
+
+        self._checkOkay()
+        return self.model.numUserCuts()
 
-                self._removeConstraint(c)
+    # Removing constraints if need be
 
     def removeConstraint(self, *constraints):
         """
@@ -1889,79 +2297,354 @@ cdef class CPlexModel(object):
           >>> m.maximize(x + y)
           10.0
 
+        All the constraints given are removed in one call.  Within
+        :meth:`batch`, they are checked here but only removed from the
+        model when the batch ends.
         """
 
         self._checkOkay()
 
-        self._checkConstraints(constraints)
-        self._removeConstraints(constraints)
+        # Nothing is removed unless all of them check out
+        cdef ConstraintPointers blocks
+        cdef list keep = [] if self.batch_ops is not None else None
 
-        
-    cpdef solve(self, objective, maximize = None, minimize = None,
-              bint recycle_variables = False, bint recycle_basis = True,
-              dict starting_dict = {}, str basis_file = None,
-              algorithm = "auto", max_threads = None, relative_gap = None):
-        """
-        Solves the current model trying to maximize (default) or
-        minimize `objective` subject to the constraints given by
-        :meth:`constrain()`.  `objective` can be any expression (as
-        described in the documentation for :class:`CPlexModel`).  The
-        function returns the value of the objective after
-        optimization.
+        self._collectConstraints(constraints, &blocks, keep)
 
-        Typically, this function is called using one of the alias
-        functions, :meth:`minimize` or :meth:`maximize`, to set the
-        sense of the optimization.  Alternatively, one can pass any of
-        the following as keyword arguments:
+        if blocks.size() == 0:
+            return
 
-          - ``maximize = True``: Sets sense to find maximum.
+        if keep is not None:
+            self._deferConstraints(-1, keep)
+            return
 
-          - ``minimize = True``: Sets sense to find minimum,
+        cdef Status s
 
-          - ``maximize = False``: Sets sense to find minimum.
-          
-          - ``minimize = False``: Sets sense to find maximum.
+        with nogil:
+            s = self.model.removeConstraints(blocks)
 
-        **Available options**
+        if s.error_code != 0:
+            raise CPlexException("Error removing constraint: %s" % s.message)
 
-        starting_dict:
+    # Batches of constraint changes
 
-          Specify starting points for variables given in a dictionary.
+    cdef _deferConstraints(self, int pool, list constraints):
+        # Consecutive changes of the same kind go in one run
 
-          For optimization problems having integer values, this may
-          give a speedup.  Note, however, that for non-integer linear
-          programs, constructing a solver state from a starting point
-          is usually as time consuming as solving it in the first
-          place, thus it is rare to get any speedup.
+        if self.batch_ops and self.batch_ops[-1][0] == pool:
+            self.batch_ops[-1][1].extend(constraints)
+        else:
+            self.batch_ops.append( (pool, constraints) )
 
-        recycle_variables:
+    def batch(self):
+        """
+        Returns a context manager that holds back the constraints
+        added with :meth:`constrain` and removed with
+        :meth:`removeConstraint` until the end of the ``with`` block,
+        then makes all the changes at once.  Adding many small
+        constraints one at a time is much slower, particularly once
+        the model has been solved, as CPlex then updates its copy of
+        the model on every call.  For example::
+
+          with m.batch() as b:
+              for i in range(n):
+                  m.constrain(x[i] <= y[i])
+
+          print b.rows, b.flush_time
+
+        The constraints are still checked in each call, but are not
+        part of the model until the batch ends, so solving the model
+        within the batch solves it without them.  Changes are made in
+        the order they were given, with consecutive additions to the
+        same pool, and consecutive removals, each done in one call as
+        a run.
+
+        When the batch ends, `rows` on the returned object gives the
+        number of constraints added or removed, and `flush_time` the
+        number of seconds making the changes took.  If the ``with``
+        block ends with an exception, the held back changes are
+        dropped.  Batches may be nested; the changes are then made at
+        the end of the outermost one.
+
+        Each run of changes is made completely or not at all, but the
+        batch as a whole is not: if CPlex refuses a run, the runs
+        before it stay applied, the rest are dropped, and a
+        :class:`CPlexException` naming the run is raised.  `rows` and
+        `flush_time` then cover the runs that were applied.
+        """
 
-          Can be True or False (default).  If True, the model has
-          already been solved at least once, and no constraints have
-          been added or removed, then the variable values from the
-          previous run are used to form the starting point for this
-          current run.  Note, however, that CPlex takes a usually
-          non-trivial amount of time to construct a basis from a given
-          starting point, so this usually doesn't help that much
-          except in combinatorial problems.
+        self._checkOkay()
+        return ConstraintBatch(self)
 
-        recycle_basis:
-        
-          Can be True or False (default).  If True, then the basis
-          from the last run of the model is used to instantiate this
-          run.  If the basis is saved from before using
-          :meth:`saveBasis`, then one should use basis_file instead.
+    def _beginBatch(self):
+        self._checkOkay()
 
-        basis_file:
+        if self.batch_depth == 0:
+            self.batch_ops = []
 
-          Specify a file to load a basis from.  This file should be
+        self.batch_depth += 1
+
+    def _endBatch(self, batch, bint flush):
+        # Sets rows and flush_time on batch as the runs are applied
+
+        self.batch_depth -= 1
+
+        if self.batch_depth > 0:
+            return
+
+        cdef list ops = self.batch_ops
+        self.batch_ops = None
+
+        if not flush or not ops:
+            return
+
+        self._checkOkay()
+
+        cdef ConstraintPointers blocks
+        cdef CPlexConstraint c
+        cdef Status s
+        cdef int pool
+        cdef long rows = 0, n_rows
+        cdef size_t run
+
+        start = time.time()
+
+        try:
+            for run, (pool, constraints) in enumerate(ops):
+                blocks.clear()
+                n_rows = 0
+
+                for c in constraints:
+                    blocks.push_back(c.data)
+                    n_rows += c.data.md().size()
+
+                if pool == -1:
+                    with nogil:
+                        s = self.model.removeConstraints(blocks)
+                else:
+                    with nogil:
+                        s = self.model.addConstraints(blocks, pool)
+
+                if s.error_code != 0:
+                    raise CPlexException(
+                        "Error %s constraints in run %d of %d of the batch (%d rows applied before it): %s"
+                        % ("removing" if pool == -1 else "adding", run + 1, len(ops), rows, s.message))
+
+                rows += n_rows
+        finally:
+            batch.rows = rows
+            batch.flush_time = time.time() - start
+
+    def update_rhs(self, constraint, rhs):
+        """
+        Changes the right hand side of the constraints in `constraint`,
+        as created by e.g. ``A*x <= b`` and added with
+        :meth:`constrain`, to `rhs`, in place.  `rhs` is a scalar or an
+        array of the shape of the constraint block.  For ``<=``
+        constraints the upper bound is set, for ``>=`` constraints the
+        lower bound, and for ``==`` constraints both; the bound is that
+        of the expression as it was written on the other side.
+
+        The constraints are not rebuilt, and a linear program is
+        re-solved starting from the previous basis.  As the change
+        would apply to clones too, it is refused while the model has
+        any; see :meth:`clone`.
+
+        Example::
+
+          >>> m = CPlexModel()
+          >>> x = m.new(2, lb = 0)
+          >>> c = (x <= array([1, 2]))
+          >>> m.constrain(c)
+          >>> m.maximize(x.sum())
+          3.0
+          >>> m.update_rhs(c, array([3, 4]))
+          >>> m.maximize(x.sum())
+          7.0
+        """
+
+        self._checkOkay()
+
+        if type(constraint) is not CPlexConstraint:
+            raise TypeError("Expected constraint, got %s." % repr(type(constraint)))
+
+        cdef CPlexConstraint c = (<CPlexConstraint>constraint)
+
+        if c.model is not self:
+            raise ValueError("Constraint not from this model.")
+
+        cdef NumericalArrayWrapper naw = newCoercedNumericalArray(
+            self, _broadcastScalar(rhs, c.data.md()), c.data.md())
+        cdef Status s
+
+        with nogil:
+            s = self.model.updateRHS(c.data[0], naw.data[0])
+
+        if s.error_code != 0:
+            raise CPlexException("Error updating right hand side: %s" % str(s.message))
+
+    def update_objective(self, CPlexExpression var, coefficients):
+        """
+        Changes the coefficients of the variables in the block `var`
+        (or a slice of one) in the objective of the last solve, in
+        place.  `coefficients` is a scalar or an array of the shape of
+        `var`.
+
+        The objective is kept, with these changes, as long as
+        :meth:`solve` is called with the same objective expression
+        object as before, so it isn't extracted again and a linear
+        program is re-solved from the previous basis.  The objective
+        expression itself is not changed.
+
+        Example::
+
+          >>> m = CPlexModel()
+          >>> x = m.new(2, lb = 0, ub = 1)
+          >>> obj = x.sum()
+          >>> m.maximize(obj)
+          2.0
+          >>> m.update_objective(x, array([2, 3]))
+          >>> m.maximize(obj)
+          5.0
+        """
+
+        self._checkOkay()
+
+        if var.model is not self:
+            raise ValueError("Variable block not from this model.")
+
+        cdef NumericalArrayWrapper naw = newCoercedNumericalArray(
+            self, _broadcastScalar(coefficients, var.data.md()), var.data.md())
+        cdef Status s
+
+        with nogil:
+            s = self.model.setObjectiveCoefs(var.data[0], naw.data[0])
+
+        if s.error_code != 0:
+            raise CPlexException("Error updating objective: %s" % str(s.message))
+
+    def update_bounds(self, CPlexExpression var, lb = None, ub = None):
+        """
+        Changes the bounds of the variables in the block `var` (or a
+        slice of one) in place.  `lb` and `ub` are scalars or arrays of
+        the shape of `var`; if either is None, those bounds are left as
+        they are.  As with :meth:`new`, NaN entries mean unbounded.
+
+        The model is not rebuilt, and a linear program is re-solved
+        starting from the previous basis.  As the change would apply
+        to clones too, it is refused while the model has any; see
+        :meth:`clone`.
+
+        Example::
+
+          >>> m = CPlexModel()
+          >>> x = m.new(3, lb = 0, ub = 1)
+          >>> m.maximize(x.sum())
+          3.0
+          >>> m.update_bounds(x, ub = array([1, 2, 3]))
+          >>> m.maximize(x.sum())
+          6.0
+        """
+
+        self._checkOkay()
+
+        if var.model is not self:
+            raise ValueError("Variable block not from this model.")
+
+        cdef NumericalArrayWrapper lb_naw = None, ub_naw = None
+        cdef NumericalArray *lb_na = NULL
+        cdef NumericalArray *ub_na = NULL
+
+        if lb is not None:
+            lb_naw = newCoercedNumericalArray(self, _boundArray(lb, var.data.md(), -IloInfinity),
+                                              var.data.md())
+            lb_na = lb_naw.data
+
+        if ub is not None:
+            ub_naw = newCoercedNumericalArray(self, _boundArray(ub, var.data.md(), IloInfinity),
+                                              var.data.md())
+            ub_na = ub_naw.data
+
+        cdef Status s
+
+        with nogil:
+            s = self.model.updateBounds(var.data[0], lb_na, ub_na)
+
+        if s.error_code != 0:
+            raise CPlexException("Error updating bounds: %s" % str(s.message))
+
+        
+    cpdef solve(self, objective, maximize = None, minimize = None,
+              bint recycle_variables = False, bint recycle_basis = True,
+              dict starting_dict = {}, str basis_file = None,
+              algorithm = None, max_threads = None, relative_gap = None,
+              mip_starts = None, mip_start_effort = "auto",
+              time_limit = None, det_time_limit = None):
+        """
+        Solves the current model trying to maximize (default) or
+        minimize `objective` subject to the constraints given by
+        :meth:`constrain()`.  `objective` can be any expression (as
+        described in the documentation for :class:`CPlexModel`), or
+        None for models loaded by :meth:`read` to use the objective
+        from the file.  The function returns the value of the
+        objective after optimization.
+
+        Typically, this function is called using one of the alias
+        functions, :meth:`minimize` or :meth:`maximize`, to set the
+        sense of the optimization.  Alternatively, one can pass any of
+        the following as keyword arguments:
+
+          - ``maximize = True``: Sets sense to find maximum.
+
+          - ``minimize = True``: Sets sense to find minimum,
+
+          - ``maximize = False``: Sets sense to find minimum.
+          
+          - ``minimize = False``: Sets sense to find maximum.
+
+        **Available options**
+
+        starting_dict:
+
+          Specify starting points for variables given in a dictionary.
+
+          For optimization problems having integer values, this may
+          give a speedup.  Note, however, that for non-integer linear
+          programs, constructing a solver state from a starting point
+          is usually as time consuming as solving it in the first
+          place, thus it is rare to get any speedup.
+
+        recycle_variables:
+
+          Can be True or False (default).  If True, the model has
+          already been solved at least once, and no constraints have
+          been added or removed, then the variable values from the
+          previous run are used to form the starting point for this
+          current run.  Note, however, that CPlex takes a usually
+          non-trivial amount of time to construct a basis from a given
+          starting point, so this usually doesn't help that much
+          except in combinatorial problems.
+
+        recycle_basis:
+        
+          Can be True or False (default).  If True, then the basis
+          from the last run of the model is used to instantiate this
+          run.  The basis is carried over in memory.  If the basis is
+          saved from before using :meth:`saveBasis`, then one should
+          use basis_file instead; :meth:`getBasis` and
+          :meth:`setBasis` give explicit control over it.
+
+        basis_file:
+
+          Specify a file to load a basis from.  This file should be
           from a previous call to :meth:`saveBasis`.
 
         algorithm:
 
-          Specify which algorithm to use.  Available options are auto
-          (default), primal, dual, barrier, sifting, concurrent, or
-          netflow.  See CPlex doumentation for the specifics..
+          Specify which algorithm to use.  Available options are auto,
+          primal, dual, barrier, sifting, concurrent, or netflow.  See
+          CPlex doumentation for the specifics.  If not given, the
+          RootAlg parameter is left as it is, which is auto unless it
+          was set with :meth:`setParameter`.
 
         max_threads:
 
@@ -1971,6 +2654,23 @@ cdef class CPlexModel(object):
 
           Specify the relative gap for the relaxed vs. integer solution.
 
+        mip_starts:
+
+          One or more MIP starts, each a dictionary mapping variable
+          blocks to values as in `starting_dict`.  These are added
+          with :meth:`addMIPStarts` before solving, using
+          `mip_start_effort`, and CPlex uses the best of them.
+
+        time_limit, det_time_limit:
+
+          Stop the solve after this many seconds, or deterministic
+          ticks, respectively.  The limits only apply to this solve;
+          the parameters (TiLim and DetTiLim) are set back afterwards.
+          If CPlex has found a solution by then, the best one is
+          kept and its objective value returned as usual; the status,
+          bound and gap are then given by :meth:`getSolveInfo`.  If it
+          has not, :class:`CPlexNoSolution` is raised.
+
         Example 1::
 
           >>> from pycpx import CPlexModel
@@ -2035,156 +2735,1293 @@ cdef class CPlexModel(object):
           >>> m[y]
           1.0
 
-        """
+        """
+
+        # Set only when called from a SolveFuture
+        cdef SolveAborter *control = self.solve_control
+        self.solve_control = NULL
+
+        self._checkOkay()
+
+        cdef Status s
+        cdef CPlexExpression var
+        cdef NumericalArrayWrapper naw
+        cdef char* b_c
+        cdef int i_param
+        cdef double d_param
+        cdef double objective_value
+
+        ################################################################################
+        # Set local parameters
+
+        cdef CPlexExpression obj
+
+        # Models from read() may be solved with the objective in the file
+        if objective is None and self.imported_objective is not None:
+            objective = self.imported_objective
+
+            if maximize is None and minimize is None:
+                maximize = self.imported_maximize
+
+        if not type(objective) is CPlexExpression:
+            raise TypeError("Objective must be an expression.")
+
+        obj = objective
+        
+        cdef bint _maximize = _objectiveSense(maximize, minimize)
+
+        ################################################################################
+        # Get any model parameters that we need from the previous model
+
+        # The values themselves stay in the model interface
+        cdef bint recycle_values = recycle_variables and self.model.solved()
+
+        cdef tuple recycled_basis = None
+
+        if recycle_basis and self.model.solved():
+            try:
+                recycled_basis = self.getBasis()
+            except CPlexException:
+                recycled_basis = None
+
+        ################################################################################
+        # Now see if we're maximizing or minimizing
+
+        with nogil:
+            s = self.model.setObjective(obj.data[0], _maximize)
+
+        if s.error_code != 0:
+            raise CPlexException("Error setting objective: %s" % s.message)
+
+        ################################################################################
+        # Now do all the stuff we were going to do, but now it's after
+        # the objective is set, so these things stay put
+
+        if algorithm is not None:
+            try:
+                i_param = model_lookup[algorithm.lower()]
+            except KeyError:
+                raise ValueError("Algorithm '%s' not recognized, can be auto, primal, dual, barrier, sifting, concurrent, or netflow." % algorithm)
+
+            with nogil:
+                self.model.setParameter(RootAlg, i_param)
+
+        if max_threads:
+            i_param = int(max_threads)
+
+            with nogil:
+                self.model.setParameter(Threads, i_param)
+
+        if relative_gap is not None:
+            d_param = float(relative_gap)
+
+            with nogil:
+                self.model.setParameter(RelativeMIPGapTolerance, d_param)
+
+        if recycled_basis is not None:
+            try:
+                self.setBasis(*recycled_basis)
+            except CPlexException:
+                pass
+
+        if basis_file is not None:
+            b = bytes(basis_file)
+            b_c = b
+
+            with nogil:
+                self.model.readBasis(b_c)
+
+        if recycle_values:
+            with nogil:
+                s = self.model.recycleSolution()
+
+            if s.error_code != 0:
+                raise CPlexException("Error setting starting values: %s" % str(s.message))
+
+        if starting_dict:
+            for var, X in starting_dict.iteritems():
+                naw = newCoercedNumericalArray(self, X, var.data.md())
+
+                with nogil:
+                    s = self.model.setStartingValues(var.data[0], naw.data[0])
+
+                if s.error_code != 0:
+                    raise CPlexException("Error setting starting values: %s" % str(s.message))
+
+        if mip_starts is not None:
+            self.addMIPStarts(mip_starts, mip_start_effort)
+
+        # Limits for this solve only
+        cdef list limits = [("TiLim", time_limit), ("DetTiLim", det_time_limit)]
+        cdef dict previous_limits = {}
+
+        for name, limit in limits:
+            if limit is not None and limit <= 0:
+                raise ValueError("%s must be positive." % ("time_limit" if name == "TiLim"
+                                                           else "det_time_limit"))
+
+        ###############################################################################
+        # Now solve it!
+        try:
+            # Only those actually changed are set back
+            for name, limit in limits:
+                if limit is not None:
+                    previous_limits[name] = self.getParameter(name)
+                    self.setParameter(name, float(limit))
+
+            with nogil:
+                s = self.model.solve(&self.last_op_time, control)
+        finally:
+            for name, limit in previous_limits.iteritems():
+                self.setParameter(name, limit)
+
+        self._raiseSeparatorError()
+
+        if s.error_code != 0:
+            if s.error_code in [MODEL_UNBOUNDED, MODEL_INFEASABLE,
+                                MODEL_UNBOUNDED_OR_INFEASABLE, MODEL_LIMIT_REACHED]:
+                
+                raise CPlexNoSolution(str(s.message))
+            
+            else:
+                raise CPlexException(str(s.message))
+
+        with nogil:
+            objective_value = self.model.getObjectiveValue()
+
+        return objective_value
+
+    def saveBasis(self, str filename):
+        """
+        Writes a basis for the current solution to a file.  This may
+        be used to reinstate a previous state of the solver at a later
+        time.
+        """
+
+        self._checkOkay()
+
+        b = bytes(filename)
+
+        cdef char* b_c = b
+        cdef Status s
+
+        with nogil:
+            s = self.model.writeBasis(b_c)
+        
+        if s.error_code != 0:
+            raise CPlexException(str(s.message))
+
+    def clone(self):
+        """
+        Returns a copy of the model, holding the same variables,
+        constraints and objective, that can then be changed without
+        affecting this one.  Nothing is rebuilt; the clone refers to the
+        same variables and expressions, and only extracting it costs
+        time.  If this model has been solved as a linear program, the
+        clone starts from its basis.  Solver parameters are not copied.
+
+        Variable blocks and other expressions of this model are used
+        with the clone through :meth:`translate`.  A model and its
+        clones share one concert environment, so only one of them is
+        solved at a time, and verbosity and :meth:`stats` apply to
+        all of them.
+
+        As the variables and constraints themselves are shared, their
+        bounds cannot be changed in place while a model has clones:
+        :meth:`update_rhs`, :meth:`update_bounds` and the `rhs` option
+        of :meth:`solve_batch` raise :class:`CPlexException` on the
+        model and on each of its clones until the others are gone.
+        Adding and removing constraints, and changing the objective,
+        only affect the model they are done on.
+
+        Example::
+
+          >>> m = CPlexModel()
+          >>> x = m.new(3, lb = 0, ub = 1)
+          >>> m.constrain(x.sum() <= 2)
+          >>> m2 = m.clone()
+          >>> x2 = m2.translate(x)
+          >>> m2.constrain(x2[0] == 0)
+          >>> m.maximize(x.sum()), m2.maximize(x2.sum())
+          (2.0, 2.0)
+          >>> m2[x2]
+          array([ 0.,  1.,  1.])
+        """
+
+        self._checkOkay()
+
+        cdef CPlexModel c = CPlexModel(self.verbosity, self)
+
+        c.rv_number = self.rv_number
+        c.variables = [c.translate(v) for v in self.variables]
+
+        if self.imported_objective is not None:
+            c.imported_objective = c.translate(self.imported_objective)
+            c.imported_maximize = self.imported_maximize
+
+        return c
+
+    def translate(self, CPlexExpression expression):
+        """
+        Returns `expression`, which may be a variable block or any
+        other expression of the model this one was cloned from (or of
+        a clone of this model), as an expression of this model.
+        Values of variable blocks are then available from this model
+        as usual.
+        """
+
+        self._checkOkay()
+
+        if expression.model is self:
+            return expression
+
+        if not self.env.sameAs(expression.model.env[0]):
+            raise ValueError("Expression does not belong to this model or to one it was cloned from.")
+
+        cdef CPlexExpression ret = newCPEFromCPEWithSameProperties(
+            expression, new ExpressionArray(expression.data[0], expression.data.md()))
+
+        ret.model = self
+        ret.original_size = expression.original_size
+        ret.key = expression.key
+
+        return ret
+
+    def write(self, str filename):
+        """
+        Writes the model to `filename` in one of the native formats of
+        CPlex, as given by the extension of `filename`: ``.sav``
+        (binary, the fastest to read back), ``.mps`` or ``.lp``, each
+        optionally followed by ``.gz``.  If `filename` has none of
+        these, ``.sav`` is appended.  Returns the name of the file
+        written.
+
+        The objective is only included once the model has been
+        solved.  Use :meth:`read` to load the model again.
+        """
+
+        self._checkOkay()
+
+        cdef str ext
+
+        for ext in [".sav", ".mps", ".lp"]:
+            if filename.lower().endswith(ext) or filename.lower().endswith(ext + ".gz"):
+                break
+        else:
+            filename += ".sav"
+
+        b = bytes(filename)
+
+        cdef char* b_c = b
+        cdef Status s
+
+        with nogil:
+            s = self.model.exportModel(b_c)
+
+        if s.error_code != 0:
+            raise CPlexException("Error writing model: %s" % str(s.message))
+
+        return filename
+
+    @staticmethod
+    def read(str filename, int verbosity = 2):
+        """
+        Reads a model written by :meth:`write`, or any other model
+        file CPlex understands, and returns a tuple ``(model,
+        variables)``.  `variables` is a dictionary mapping the name of
+        each variable block to the block; blocks created by
+        :meth:`new` are recovered from the variable names with their
+        original shape, so that ``model[x]`` works as before (the SAV
+        and MPS formats keep the names exactly; the LP format may
+        not).  Blocks created without a name
+        appear under the names ``_1``, ``_2``, etc. described in
+        :meth:`new`; if several blocks share a name, only the first is
+        in the dictionary.  Each variable is placed in its block by
+        the indices in its name, whatever the order of the variables
+        in the file.  If the indices of a block leave gaps or repeat,
+        its variables appear as scalars under their full names, e.g.
+        ``'x[3]'``, instead.
+
+        The objective read from the file, along with its sense, is
+        used when :meth:`solve` is called with None as objective.
+        All constraints read form a single block; they can't be
+        removed individually.
+
+        Example::
+
+          >>> m, variables = CPlexModel.read('model.sav')
+          >>> m.solve(None)
+          6.0
+          >>> m[variables['x']]
+          array([ 1.,  1.,  1.])
+        """
+
+        cdef CPlexModel m = CPlexModel(verbosity)
+
+        b = bytes(filename)
+
+        cdef char* b_c = b
+        cdef Status s
+
+        with nogil:
+            s = m.model.importModel(b_c)
+
+        if s.error_code != 0:
+            raise CPlexException("Error reading model: %s" % str(s.message))
+
+        cdef long i, n_blocks = m.model.numImportedBlocks()
+        cdef ExpressionArray *ea
+        cdef string name
+        cdef int name_mode
+        cdef CPlexExpression v
+        cdef dict variables = {}
+
+        for i in range(n_blocks):
+            with nogil:
+                ea = m.model.importedBlock(i, &name, &name_mode)
+
+            v = newCPEwithVariables(m, ea)
+
+            if name_mode == VAR_NAME_SCALAR:
+                v.original_size = s_scalar
+            elif name_mode == VAR_NAME_ARRAY:
+                v.original_size = ea.md().shape(0)
+            else:
+                v.original_size = (ea.md().shape(0), ea.md().shape(1))
+
+            m.rv_number += 1
+            v.key = "%s-%s" % (id(m), m.rv_number)
+            m.variables.append(v)
+
+            block_name = str(name.c_str())
+
+            if block_name not in variables:
+                variables[block_name] = v
+
+        with nogil:
+            ea = m.model.importedObjective()
+
+        if ea != NULL:
+            m.imported_objective = newCPEFromExisting(m, ea)
+            m.imported_maximize = m.model.importedObjectiveMaximizes()
+
+        return (m, variables)
+
+    def addMIPStarts(self, starts, effort = "auto"):
+        """
+        Adds one or more MIP starts for the next solves.  `starts` is
+        a dictionary mapping variable blocks (or slices of them) to
+        their values, or a list of such dictionaries.  Each dictionary
+        is handed to CPlex as a single start, however many blocks it
+        covers, and CPlex keeps the best feasible one.
+
+        `effort` says how hard CPlex should work to turn a start into
+        a feasible solution; it may be 'auto' (default), 'check' (only
+        check feasibility), 'solve_fixed' (solve with the integer
+        variables fixed), 'solve_mip' (solve a subproblem), or
+        'repair' (repair an infeasible start).
+
+        Starts stay with the model until :meth:`clearMIPStarts` is
+        called.
+        """
+
+        self._checkOkay()
+
+        try:
+            effort_code = mip_start_effort_lookup[effort.lower()]
+        except (KeyError, AttributeError):
+            raise ValueError("MIP start effort '%s' not recognized, can be auto, check, "
+                             "solve_fixed, solve_mip or repair." % effort)
+
+        if type(starts) is dict:
+            starts = [starts]
+
+        cdef int effort_i = effort_code
+        cdef CPlexExpression var
+        cdef NumericalArrayWrapper naw
+        cdef Status s
+
+        for start in starts:
+            if type(start) is not dict:
+                raise TypeError("MIP starts must be given as dictionaries.")
+
+            try:
+                for var_block, X in (<dict>start).iteritems():
+                    if type(var_block) is not CPlexExpression:
+                        raise TypeError("MIP start keys must be variable blocks.")
+
+                    var = var_block
+
+                    if var.model is not self:
+                        raise ValueError("Variables in MIP start not from this model.")
+
+                    naw = newCoercedNumericalArray(self, X, var.data.md())
+
+                    with nogil:
+                        s = self.model.addMIPStartValues(var.data[0], naw.data[0])
+
+                    if s.error_code != 0:
+                        raise CPlexException("Error setting MIP start: %s" % str(s.message))
+            except:
+                with nogil:
+                    self.model.discardMIPStart()
+                raise
+
+            with nogil:
+                s = self.model.commitMIPStart(effort_i)
+
+            if s.error_code != 0:
+                raise CPlexException("Error adding MIP start: %s" % str(s.message))
+
+    def clearMIPStarts(self):
+        """
+        Removes all MIP starts added by :meth:`addMIPStarts`.
+        """
+
+        self._checkOkay()
+
+        cdef Status s
+
+        with nogil:
+            s = self.model.clearMIPStarts()
+
+        if s.error_code != 0:
+            raise CPlexException("Error clearing MIP starts: %s" % str(s.message))
+
+    def setParameter(self, str name, value):
+        """
+        Sets a CPlex parameter by name.  Names are those of the CPlex
+        concert parameters, without regard to case; the ones available
+        are given by :meth:`getParameterNames`.  For example::
+
+          >>> m.setParameter('WorkMem', 2048)       # MB of working memory
+          >>> m.setParameter('NodeFileInd', 3)      # node files on disk
+          >>> m.setParameter('WorkDir', '/scratch')
+          >>> m.setParameter('ParallelMode', 1)     # deterministic
+          >>> m.setParameter('MIPEmphasis', 1)      # feasibility
+          >>> m.setParameter('CutUp', 1250.0)
+          >>> m.setParameter('TiLim', 60)
+          >>> m.setParameter('DetTiLim', 50000)
+
+        The value must be of the type the parameter takes.  Parameters
+        stay set for all later solves, except that :meth:`solve` sets
+        RootAlg, Threads and EpGap itself when its `algorithm`,
+        `max_threads` and `relative_gap` options are used.
+        """
+
+        self._checkOkay()
+
+        b = bytes(name)
+
+        cdef char* name_c = b
+        cdef int kind = parameterKind(name_c)
+        cdef double d_value
+        cdef char* s_value
+        cdef Status s
+
+        if kind == PARAM_UNKNOWN:
+            raise ValueError("Parameter '%s' not recognized." % name)
+
+        if kind == PARAM_STRING:
+            if not isinstance(value, str):
+                raise TypeError("Parameter '%s' takes a string." % name)
+
+            bv = bytes(value)
+            s_value = bv
+
+            with nogil:
+                s = self.model.setStringParameter(name_c, s_value)
+
+        else:
+            if isinstance(value, str):
+                raise TypeError("Parameter '%s' takes a number." % name)
+
+            d_value = value
+
+            if kind in (PARAM_INT, PARAM_LONG, PARAM_BOOL) and d_value != int(d_value):
+                raise TypeError("Parameter '%s' takes an integer." % name)
+
+            with nogil:
+                s = self.model.setNamedParameter(name_c, d_value)
+
+        if s.error_code != 0:
+            raise CPlexException("Error setting parameter '%s': %s" % (name, str(s.message)))
+
+    def getParameter(self, str name):
+        """
+        Returns the current value of the CPlex parameter `name`, as an
+        int, float, bool or string depending on the parameter.  See
+        :meth:`setParameter`.
+        """
+
+        self._checkOkay()
+
+        b = bytes(name)
+
+        cdef char* name_c = b
+        cdef int kind = parameterKind(name_c)
+        cdef double d_value = 0
+        cdef string s_value
+        cdef Status s
+
+        if kind == PARAM_UNKNOWN:
+            raise ValueError("Parameter '%s' not recognized." % name)
+
+        if kind == PARAM_STRING:
+            with nogil:
+                s = self.model.getStringParameter(name_c, &s_value)
+        else:
+            with nogil:
+                s = self.model.getNamedParameter(name_c, &d_value)
+
+        if s.error_code != 0:
+            raise CPlexException("Error getting parameter '%s': %s" % (name, str(s.message)))
+
+        if kind == PARAM_STRING:
+            return s_value.c_str()
+        elif kind == PARAM_BOOL:
+            return d_value != 0
+        elif kind == PARAM_NUM:
+            return d_value
+        else:
+            return int(d_value)
+
+    def getParameterNames(self):
+        """
+        Returns a list of the parameter names :meth:`setParameter` and
+        :meth:`getParameter` accept.
+        """
+
+        cdef long i
+
+        return [parameterName(i) for i in range(numParameters())]
+
+    def readParameters(self, str filename):
+        """
+        Reads a set of parameters from a CPlex parameter file (.prm),
+        as written by :meth:`writeParameters`.  Parameters not in the
+        file keep their current values.
+        """
+
+        self._checkOkay()
+
+        b = bytes(filename)
+
+        cdef char* b_c = b
+        cdef Status s
+
+        with nogil:
+            s = self.model.readParameters(b_c)
+
+        if s.error_code != 0:
+            raise CPlexException("Error reading parameters: %s" % str(s.message))
+
+    def writeParameters(self, str filename):
+        """
+        Writes all parameters that differ from their defaults to a
+        CPlex parameter file (.prm).
+        """
+
+        self._checkOkay()
+
+        b = bytes(filename)
+
+        cdef char* b_c = b
+        cdef Status s
+
+        with nogil:
+            s = self.model.writeParameters(b_c)
+
+        if s.error_code != 0:
+            raise CPlexException("Error writing parameters: %s" % str(s.message))
+
+    def resetParameters(self):
+        """
+        Sets all CPlex parameters back to their default values.
+        """
+
+        self._checkOkay()
+
+        cdef Status s
+
+        with nogil:
+            s = self.model.setDefaultParameters()
+
+        if s.error_code != 0:
+            raise CPlexException("Error resetting parameters: %s" % str(s.message))
+
+    def getBasis(self):
+        """
+        Returns the basis of the current solution as a tuple
+        ``(variable_status, constraint_status)`` of int32 arrays.  The
+        first holds one entry per variable, in the order the variables
+        were created by :meth:`new`; the second one entry per
+        constraint, in the order they were added by :meth:`constrain`.
+        The codes are those of CPlex: 1 = basic, 2 = at lower bound, 3
+        = at upper bound, 4 = free or superbasic.
+
+        The basis is held in memory only; pass it to :meth:`setBasis`
+        to start a later solve from it.  Only available after a linear
+        program has been solved.
+        """
+
+        self._checkOkay()
+
+        cdef long n_vars, n_cstr
+
+        with nogil:
+            n_vars = self.model.getNumVariables()
+            n_cstr = self.model.getNumConstraints()
+
+        cdef ar[int32_t, mode="c"] var_status = empty(n_vars, dtype=int32)
+        cdef ar[int32_t, mode="c"] cstr_status = empty(n_cstr, dtype=int32)
+        cdef Status s
+
+        with nogil:
+            s = self.model.getBasis(<int*>var_status.data, n_vars,
+                                    <int*>cstr_status.data, n_cstr)
+
+        if s.error_code != 0:
+            raise CPlexException("Error retrieving basis: %s" % str(s.message))
+
+        return (var_status, cstr_status)
+
+    def setBasis(self, variable_status, constraint_status):
+        """
+        Sets the basis the next solve starts from.  The arguments are
+        in the form returned by :meth:`getBasis`, and must match the
+        current numbers of variables and constraints.
+        """
+
+        self._checkOkay()
+
+        cdef ar[int32_t, mode="c"] var_status = asarray(variable_status, dtype=int32).ravel()
+        cdef ar[int32_t, mode="c"] cstr_status = asarray(constraint_status, dtype=int32).ravel()
+        cdef long n_vars = var_status.shape[0], n_cstr = cstr_status.shape[0]
+        cdef Status s
+
+        with nogil:
+            s = self.model.setBasis(<int*>var_status.data, n_vars,
+                                    <int*>cstr_status.data, n_cstr)
+
+        if s.error_code != 0:
+            raise CPlexException("Error setting basis: %s" % str(s.message))
+
+    def monitorProgress(self, bint enabled = True, long capacity = 4096, bint copy_incumbent = False):
+        """
+        Turns progress monitoring of the MIP search on or off.  While
+        on, every solve records a sample at each node and incumbent
+        reported by CPlex in a buffer holding up to `capacity`
+        samples, which :meth:`getProgress` reads from any thread while
+        the solve is running (e.g. one started with
+        :meth:`solve_async`).  If nobody reads the buffer, further
+        samples are dropped until it is read again.
+
+        If `copy_incumbent` is True, the values of all the variables
+        in each new incumbent are copied as well; see
+        :meth:`getIncumbent`.
+
+        Recording the samples does not involve the Python interpreter,
+        so the overhead on the solve is small.  Takes effect on the
+        next solve.
+        """
+
+        self._checkOkay()
+
+        if enabled and capacity <= 0:
+            raise ValueError("capacity must be positive.")
+
+        if not enabled:
+            capacity = 0
+
+        with nogil:
+            self.model.setProgressMonitor(capacity, copy_incumbent)
+
+    def getProgress(self):
+        """
+        Returns, and removes from the buffer, the progress samples
+        recorded since the last call, as a record array with the
+        fields
+
+          ``time``, ``det_time``: Seconds and deterministic ticks since
+          the start of the solve.
+
+          ``best_bound``: The best bound on the objective.
+
+          ``incumbent``, ``gap``: The objective value of the incumbent
+          and the relative MIP gap, or nan if there is no incumbent yet.
+
+          ``nodes``: The number of nodes processed.
+
+        Returns an empty array if monitoring is off; see
+        :meth:`monitorProgress`.  This may be called while the model
+        is being solved in another thread.
+        """
+
+        self._checkOkay()
+
+        cdef long n, n_available
+
+        with nogil:
+            n_available = self.model.progressAvailable()
+
+        cdef ar samples = empty(n_available, dtype=progress_dtype)
+
+        with nogil:
+            n = self.model.getProgress(<ProgressSample*>samples.data, n_available)
+
+        return samples[:n]
+
+    def getProgressDropped(self):
+        """
+        Returns the number of progress samples dropped so far because
+        the buffer was full.
+        """
+
+        self._checkOkay()
+
+        cdef long n
+
+        with nogil:
+            n = self.model.progressDropped()
+
+        return n
+
+    def getIncumbent(self):
+        """
+        Returns the latest incumbent found during the current or last
+        solve as a tuple ``(objective, values)``, where `values` holds
+        one entry per variable in the order the variables were created
+        by :meth:`new`.  Returns None if there is no incumbent yet.
+
+        Requires monitoring to be turned on with `copy_incumbent`; see
+        :meth:`monitorProgress`.  This may be called while the model is
+        being solved in another thread.
+        """
+
+        self._checkOkay()
+
+        cdef long n, n_vars
+        cdef double objective = 0
+
+        with nogil:
+            n_vars = self.model.getIncumbent(NULL, 0, &objective)
+
+        if n_vars < 0:
+            return None
+
+        cdef ar[double, mode="c"] values = empty(n_vars, dtype=float64)
+
+        with nogil:
+            n = self.model.getIncumbent(<double*>values.data, n_vars, &objective)
+
+        # New variables may have been added in between
+        if n != n_vars:
+            return self.getIncumbent()
+
+        return (objective, values)
+
+    def setLazyConstraintCallback(self, function, *variables):
+        """
+        Generates lazy constraints during a MIP solve with `function`,
+        which CPlex calls at each candidate integer solution.  It is
+        passed the candidate values of the variable blocks given in
+        `variables`, as one 2d array per block, and returns the
+        constraints the candidate violates, as a constraint, a list of
+        constraints, or None if there are none.  They are built as for
+        :meth:`constrain` and added to the model's lazy constraints.
+        For example, to cut off subtours in a routing model::
+
+          def separate(X):
+              S = find_subtour(X)
+              if S is not None:
+                  return (x_edges_within(S).sum() <= len(S) - 1)
+
+          m.setLazyConstraintCallback(separate, X)
+
+        The arrays passed to `function` are reused between calls, so
+        they must be copied if they are kept.  Calls never overlap,
+        even when CPlex runs several threads.  If `function` raises an
+        exception, the solve is stopped and the exception is raised
+        again by :meth:`solve`.  Passing None as `function` removes
+        the callback.  Takes effect on the next solve.
+        """
+
+        self._checkOkay()
+
+        cdef CPlexExpression v
+        cdef Status s
+        cdef long n = 0
+
+        for v in variables:
+            if v.model is not self:
+                raise ValueError("Variable block not from this model.")
+
+        with nogil:
+            self.model.setLazySeparator(NULL, NULL)
+
+        self.lazy_function = None
+        self.lazy_buffer = None
+        self.lazy_views = None
+
+        if function is None:
+            return
+
+        if not callable(function):
+            raise TypeError("Lazy constraint callback must be callable.")
+
+        for v in variables:
+            with nogil:
+                s = self.model.addSeparatedVariables(v.data[0])
+
+            if s.error_code != 0:
+                with nogil:
+                    self.model.setLazySeparator(NULL, NULL)
+
+                raise CPlexException("Error setting lazy constraint callback: %s" % str(s.message))
+
+            n += v.data.md().shape(0) * v.data.md().shape(1)
+
+        # The views into the buffer are made once, so each call only
+        # copies the values in
+        cdef long d_0, d_1, offset = 0
+        cdef list views = []
+
+        self.lazy_buffer = empty(n, dtype=float64)
+
+        for v in variables:
+            d_0, d_1 = v.data.md().shape(0), v.data.md().shape(1)
+            views.append(self.lazy_buffer[offset:offset + d_0*d_1].reshape( (d_0, d_1) ))
+            offset += d_0*d_1
+
+        self.lazy_views = tuple(views)
+        self.lazy_function = function
+
+        with nogil:
+            self.model.setLazySeparator(_separateLazy, <void*>self)
+
+    cdef int _separate(self, double* values, long n, LazySeparatorI* separator):
+
+        if self.lazy_error is not None:
+            return 1
+
+        try:
+            if n != self.lazy_buffer.shape[0]:
+                raise CPlexException("Lazy constraint callback got %d values, expected %d."
+                                     % (n, self.lazy_buffer.shape[0]))
+
+            if n != 0:
+                memcpy(self.lazy_buffer.data, values, n*sizeof(double))
+
+            cuts = self.lazy_function(*self.lazy_views)
+
+            if cuts is not None:
+                self._addLazyCuts(cuts, separator)
+
+        except BaseException:
+            self.lazy_error = sys.exc_info()
+            return 1
+
+        return 0
+
+    cdef _addLazyCuts(self, cuts, LazySeparatorI* separator):
+
+        cdef CPlexConstraint c
+        cdef string error
+        cdef bint okay
+
+        if type(cuts) is list or type(cuts) is tuple:
+            for ce in cuts:
+                self._addLazyCuts(ce, separator)
+
+        elif cuts is True:
+            # (x == x), which gets compared by id
+            return
+
+        elif type(cuts) is not CPlexConstraint:
+            raise TypeError("Lazy constraint callback must return constraints, got %s."
+                            % repr(type(cuts)))
+
+        elif (<CPlexConstraint>cuts).model is not self:
+            raise CPlexException("Lazy constraint not from this model.")
+
+        else:
+            c = cuts
+
+            while c is not None:
+                with nogil:
+                    okay = separator.addConstraints(c.data[0], &error)
+
+                if not okay:
+                    raise CPlexException("Error adding lazy constraint: %s" % str(error.c_str()))
+
+                c = c.hooked_constraint
+
+    cdef _raiseSeparatorError(self):
+        # Raises what the lazy constraint callback raised in the last solve
+
+        if self.lazy_error is None:
+            return
+
+        t, v, tb = self.lazy_error
+        self.lazy_error = None
+
+        raise t, v, tb
+
+    def maximize(self, objective, **options):
+        """
+        Solves the model by maximizing `objective`. This function
+        accepts the same options as :meth:`solve`, with the exception
+        of `maximize` or `mininmize`.
+        """
+
+        return self.solve(objective, maximize = True, **options)
+
+    def minimize(self, objective, **options):
+        """
+        Solves the model by minimizing `objective`.  This function
+        accepts the same options as :meth:`solve`, with the exception
+        of `maximize` or `mininmize`.
+        """
+
+        return self.solve(objective, maximize = False, **options)
+
+    def solve_batch(self, objective, objectives = None, variables = None,
+                    rhs = None, constraint = None, values = None,
+                    maximize = None, minimize = None):
+        """
+        Solves the model once for each of a number of scenarios, all
+        in one call, and returns a tuple ``(objective_values,
+        solutions)`` of numpy arrays.  `objective`, `maximize` and
+        `minimize` are as for :meth:`solve`.
+
+        Row ``k`` of the 2d array `objectives` gives the objective
+        coefficients of the variable block `variables` in scenario
+        ``k``, as set by :meth:`update_objective`, and row ``k`` of
+        `rhs` the right hand side of the constraint block
+        `constraint`, as set by :meth:`update_rhs`.  Either or both
+        may be given; if both, they must have the same number of rows.
+
+        `objective_values` holds the objective value of each scenario,
+        and `solutions`, if the variable block `values` is given, the
+        values of `values` in each scenario, stacked along the first
+        axis; e.g. for a block of shape ``(n, m)`` and ``s``
+        scenarios, it has shape ``(s, n, m)``.  Otherwise it is None.
+        Infeasible or unbounded scenarios, and those stopped by a limit
+        before a solution was found, give NaN.
+
+        The model is changed in place from one scenario to the next,
+        so it is extracted only once and each solve starts from the
+        previous one.  The model is left in the state of the last
+        scenario.  As with :meth:`update_rhs`, `rhs` may not be given
+        while the model has clones.  A lazy constraint callback set
+        with :meth:`setLazyConstraintCallback` and progress monitoring
+        apply to every scenario.
+
+        Example::
+
+          >>> m = CPlexModel()
+          >>> x = m.new(2, lb = 0, ub = 1)
+          >>> c = (x.sum() <= 1)
+          >>> m.constrain(c)
+          >>> obj, X = m.solve_batch(x.sum(), objectives = array([[1, 2], [3, 1]]),
+          ...                        variables = x, values = x, maximize = True)
+          >>> obj
+          array([ 2.,  3.])
+          >>> X
+          array([[ 0.,  1.],
+                 [ 1.,  0.]])
+        """
+
+        self._checkOkay()
+
+        if type(objective) is not CPlexExpression:
+            raise TypeError("Objective must be an expression.")
+
+        cdef CPlexExpression obj = objective
+        cdef bint _maximize = _objectiveSense(maximize, minimize)
+
+        cdef long n = -1
+        cdef ExpressionArray *cost_vars = NULL
+        cdef ExpressionArray *value_vars = NULL
+        cdef ConstraintArray *cstr = NULL
+        cdef double *costs_p = NULL
+        cdef double *rhs_p = NULL
+        cdef ar[double, ndim=2, mode="c"] C = None, B = None, V = None
+        cdef CPlexExpression v
+        cdef CPlexConstraint c
+
+        if objectives is not None:
+            if type(variables) is not CPlexExpression:
+                raise TypeError("objectives requires a variable block as variables.")
+
+            v = variables
+
+            if v.model is not self:
+                raise ValueError("Variable block not from this model.")
+
+            C = array(objectives, dtype=float_, order="C", ndmin = 2)
+
+            if C.shape[1] != v.data.md().size():
+                raise ValueError("objectives must have one column per variable in variables.")
+
+            n = C.shape[0]
+            cost_vars = v.data
+            costs_p = <double*>C.data
+
+        if rhs is not None:
+            if type(constraint) is not CPlexConstraint:
+                raise TypeError("rhs requires a constraint block as constraint.")
+
+            c = constraint
+
+            if c.model is not self:
+                raise ValueError("Constraint not from this model.")
+
+            B = array(rhs, dtype=float_, order="C", ndmin = 2)
+
+            if B.shape[1] != c.data.md().size():
+                raise ValueError("rhs must have one column per constraint in constraint.")
+
+            if n != -1 and B.shape[0] != n:
+                raise ValueError("objectives and rhs must have the same number of rows.")
+
+            n = B.shape[0]
+            cstr = c.data
+            rhs_p = <double*>B.data
+
+        if n == -1:
+            raise ValueError("Either objectives or rhs must be given.")
+
+        cdef long n_values = 0
+
+        if values is not None:
+            v = values
+
+            if v.model is not self:
+                raise ValueError("Variable block not from this model.")
 
-        self._checkOkay()
+            value_vars = v.data
+            n_values = v.data.md().size()
+
+        cdef ar[double, mode="c"] objective_values = empty(n)
+        V = empty( (n, n_values) )
 
         cdef Status s
-        cdef CPlexExpression var
 
-        ################################################################################
-        # Set local parameters
+        with nogil:
+            s = self.model.setObjective(obj.data[0], _maximize)
 
-        cdef CPlexExpression obj
+        if s.error_code != 0:
+            raise CPlexException("Error setting objective: %s" % s.message)
 
-        if not type(objective) is CPlexExpression:
-            raise TypeError("Objective must be an expression.")
+        with nogil:
+            s = self.model.solveBatch(n, cost_vars, costs_p, cstr, rhs_p, value_vars,
+                                      <double*>objective_values.data, <double*>V.data)
 
-        obj = objective
-        
-        cdef bint _maximize = True, _minimize = False
+        self._raiseSeparatorError()
 
-        if maximize is not None and minimize is None:
-            _maximize = maximize
-            _minimize = not _maximize
-            
-        elif maximize is None and minimize is not None:
-            _maximize = not minimize
-            _minimize = not _maximize
-            
-        elif maximize is not None and minimize is not None:
-            _maximize = maximize
-            _minimize = minimize
+        if s.error_code != 0:
+            raise CPlexException("Error solving scenarios: %s" % str(s.message))
 
-            if _maximize == _minimize:
-                raise ValueError("Cannot both maximize and minimize the problem at the same time.")
+        if values is None:
+            return (objective_values, None)
 
-        ################################################################################
-        # Get any model parameters that we need from the previous model
+        size = v.original_size
 
-        cdef list recycle_variable_values = None
+        if size == s_scalar:
+            return (objective_values, V[:,0])
+        elif isscalar(size) or (type(size) is tuple and len(<tuple>size) == 1):
+            return (objective_values, V)
+        else:
+            return (objective_values, V.reshape(n, v.data.md().shape(0), v.data.md().shape(1)))
 
-        if recycle_variables and self.model.solved():
-            recycle_variable_values = [self.value(v) for v in self.variables]
+    def populate(self, objective, capacity = None, gap = None, replace = None,
+                 intensity = None, limit = None, maximize = None, minimize = None):
+        """
+        Fills the solution pool of a MIP with up to `limit` (CPlex's
+        default is 20) solutions, optimizing `objective` as for
+        :meth:`solve`, and returns the number of solutions in the
+        pool.  They are then read with :meth:`getPoolValues` and
+        :meth:`getPoolObjectives`.
 
-        cdef str tmp_basis_file_name = None
-        
-        if recycle_basis and self.model.solved():
-            tmp_basis_file, tmp_basis_file_name = tempfile.mkstemp(suffix='bas', prefix='tmp_cplex')
-            
-            b = bytes(tmp_basis_file_name)
-            self.model.writeBasis(b)
+        The other options set the corresponding solver parameters,
+        which stay set for later solves; None leaves a parameter as it
+        is:
 
-        try:
+          capacity: The maximum number of solutions kept in the pool
+          (SolnPoolCapacity).
 
-            ################################################################################
-            # Now see if we're maximizing or minimizing
+          gap: Only keep solutions within this relative gap of the
+          best one (SolnPoolGap).
 
-            s = self.model.setObjective(obj.data[0], _maximize)
+          replace: Which solution is replaced once the pool is full;
+          'oldest', 'objective' (the worst) or 'diversity'
+          (SolnPoolReplace).
 
-            if s.error_code != 0:
-                raise CPlexException("Error setting objective: %s" % s.message)
+          intensity: How hard to look for solutions, 0 (automatic)
+          to 4 (SolnPoolIntensity).
+
+          limit: The number of solutions to generate (PopulateLim).
+
+        Example::
+
+          >>> m = CPlexModel()
+          >>> x = m.new(3, vtype = bool)
+          >>> m.constrain(x.sum() <= 2)
+          >>> m.populate(x.sum(), maximize = True, gap = 0)
+          3
+          >>> m.getPoolValues(x).shape
+          (3, 3, 1)
+        """
 
-            ################################################################################
-            # Now do all the stuff we were going to do, but now it's after
-            # the objective is set, so these things stay put
+        self._checkOkay()
+
+        if type(objective) is not CPlexExpression:
+            raise TypeError("Objective must be an expression.")
+
+        cdef CPlexExpression obj = objective
+        cdef bint _maximize = _objectiveSense(maximize, minimize)
 
+        if capacity is not None:
+            self.setParameter("SolnPoolCapacity", int(capacity))
+
+        if gap is not None:
+            self.setParameter("SolnPoolGap", float(gap))
+
+        if replace is not None:
             try:
-                self.model.setParameter(RootAlg, <int> model_lookup[algorithm.lower()])
-            except KeyError:
-                raise ValueError("Algorithm '%s' not recognized, can be auto, primal, dual, barrier, sifting, concurrent, or netflow.")
+                self.setParameter("SolnPoolReplace", pool_replace_lookup[replace.lower()])
+            except (KeyError, AttributeError):
+                raise ValueError("replace must be 'oldest', 'objective', or 'diversity'.")
 
-            if max_threads:
-                self.model.setParameter(Threads, <int> int(max_threads))
+        if intensity is not None:
+            self.setParameter("SolnPoolIntensity", int(intensity))
 
-            if relative_gap is not None:
-                self.model.setParameter(RelativeMIPGapTolerance, float(relative_gap))
+        if limit is not None:
+            self.setParameter("PopulateLim", int(limit))
 
-            if tmp_basis_file_name is not None:
-                b = bytes(tmp_basis_file_name)
-                self.model.readBasis(b)
+        cdef Status s
 
-            if basis_file is not None:
-                b = bytes(basis_file)
-                self.model.readBasis(b)
+        with nogil:
+            s = self.model.setObjective(obj.data[0], _maximize)
 
-            if recycle_variable_values is not None:
+        if s.error_code != 0:
+            raise CPlexException("Error setting objective: %s" % s.message)
 
-                for var, val in zip(self.variables, recycle_variable_values):
-                    s = self.model.setStartingValues(
-                        var.data[0], newCoercedNumericalArray(val, var.data.md()).data[0])
-                    if s.error_code != 0:
-                        raise CPlexException("Error setting starting values: %s" % str(s.message))
+        with nogil:
+            s = self.model.populate(&self.last_op_time)
 
-            if starting_dict:
-                for var, X in starting_dict.iteritems():
-                    s = self.model.setStartingValues(
-                        var.data[0], newCoercedNumericalArray(X, var.data.md()).data[0])
-                    if s.error_code != 0:
-                        raise CPlexException("Error setting starting values: %s" % str(s.message))
+        self._raiseSeparatorError()
 
-            ###############################################################################
-            # Now solve it!
-            s = self.model.solve(&self.last_op_time)
+        if s.error_code != 0:
+            raise CPlexNoSolution("Error populating solution pool: %s" % s.message)
 
-            if s.error_code != 0:
-                if s.error_code in [MODEL_UNBOUNDED, MODEL_INFEASABLE,
-                                    MODEL_UNBOUNDED_OR_INFEASABLE]:
-                    
-                    raise CPlexNoSolution(str(s.message))
-                
-                else:
-                    raise CPlexException(str(s.message))
-                
-            return self.model.getObjectiveValue()
-        
-        finally:
-            if tmp_basis_file_name is not None:
-                os.remove(tmp_basis_file_name)
+        return self.getPoolSize()
 
-    def saveBasis(self, str filename):
+    def getPoolSize(self):
         """
-        Writes a basis for the current solution to a file.  This may
-        be used to reinstate a previous state of the solver at a later
-        time.
+        Returns the number of solutions in the solution pool, from the
+        last call to :meth:`populate` or, for a MIP, :meth:`solve`.
         """
 
         self._checkOkay()
 
-        b = bytes(filename)
-        
-        cdef Status s = self.model.writeBasis(b)
-        
+        cdef long n
+
+        with nogil:
+            n = self.model.getNumPoolSolutions()
+
+        return n
+
+    def getPoolObjectives(self):
+        """
+        Returns the objective values of all solutions in the solution
+        pool as a 1d array.
+        """
+
+        self._checkOkay()
+
+        cdef long n = self.getPoolSize()
+        cdef ar[double, mode="c"] X = empty(n)
+        cdef Status s
+
+        with nogil:
+            s = self.model.getPoolObjectives(<double*>X.data, n)
+
         if s.error_code != 0:
-            raise CPlexException(str(s.message))
+            raise CPlexException("Error retrieving pool objectives: %s" % str(s.message))
 
-    def maximize(self, objective, **options):
+        return X
+
+    def getPoolValues(self, CPlexExpression var):
         """
-        Solves the model by maximizing `objective`. This function
-        accepts the same options as :meth:`solve`, with the exception
-        of `maximize` or `mininmize`.
+        Returns the values of the variable block or expression `var`
+        in all solutions in the solution pool, as one array of shape
+        ``(k, n, m)`` for ``k`` solutions and `var` of shape ``(n,
+        m)``.  Column vectors have ``m = 1``.  Variable blocks are
+        read with one call into CPlex per solution.
         """
 
-        return self.solve(objective, maximize = True, **options)
+        self._checkOkay()
 
-    def minimize(self, objective, **options):
+        if var.model is not self:
+            raise ValueError("Variable block not from this model.")
+
+        cdef long n = self.getPoolSize()
+        cdef long d_0 = var.data.md().shape(0), d_1 = var.data.md().shape(1)
+        cdef ar[double, ndim=3, mode="c"] X = empty( (n, d_0, d_1) )
+        cdef Status s
+
+        with nogil:
+            s = self.model.getPoolValues(<double*>X.data, n, var.data[0])
+
+        if s.error_code != 0:
+            raise CPlexException("Error retrieving pool values: %s" % str(s.message))
+
+        return X
+
+    def solve_async(self, objective, **options):
         """
-        Solves the model by minimizing `objective`.  This function
-        accepts the same options as :meth:`solve`, with the exception
-        of `maximize` or `mininmize`.
+        Starts solving the model on a background thread and returns a
+        :class:`SolveFuture` right away.  `objective` and all keyword
+        options are the same as for :meth:`solve`; the objective value
+        is available from the future's ``result()`` once the solve
+        finishes, and the model may be queried as usual after that.
+
+        Calling ``cancel()`` on the future cancels the solve if it has
+        not started yet; ``abort()`` stops it even if it is already
+        running.  For use with asyncio, wrap the future with
+        ``asyncio.wrap_future``.
+
+        Example::
+
+          >>> f = m.solve_async(x.sum(), maximize = True)
+          >>> # ... do other work ...
+          >>> f.result(timeout = 10)
+          12.0
+
+        Requires the ``concurrent.futures`` module (the ``futures``
+        package on Python 2).
         """
 
-        return self.solve(objective, maximize = False, **options)
+        self._checkOkay()
+
+        if _FutureBase is object:
+            raise CPlexException("solve_async requires the concurrent.futures module.")
+
+        if type(objective) is not CPlexExpression:
+            raise TypeError("Objective must be an expression.")
+
+        return SolveFuture(self, objective, options)
+
+    cdef _solveWithControl(self, _SolveAborter aborter, objective, dict options):
+        self.solve_control = aborter.ptr
+
+        try:
+            return self.solve(objective, **options)
+        finally:
+            self.solve_control = NULL
 
     def getSolverTime(self):
         """
@@ -2195,6 +4032,58 @@ cdef class CPlexModel(object):
 
         return self.last_op_time
 
+    def getSolveInfo(self):
+        """
+        Returns a dictionary describing how the previous solve ended:
+
+          ``'status'``: One of ``'optimal'``; ``'feasible'``, if the
+          solve was stopped by a time or other limit with a solution;
+          ``'limit_reached'``, if it was stopped before finding one;
+          ``'infeasible'``, ``'unbounded'``,
+          ``'infeasible_or_unbounded'``, ``'aborted'``, ``'error'``,
+          or ``'none'`` if the model has not been solved.
+
+          ``'objective'``: The objective value of the solution, or nan
+          if there is none.
+
+          ``'best_bound'``, ``'gap'``: The best bound on the objective
+          and the relative gap between it and the solution; nan when
+          not known.  For linear programs solved to optimality, these
+          are the objective and 0.
+
+          ``'nodes'``: The number of branch and bound nodes processed.
+
+          ``'cplex_status'``: The status code returned by CPlex.
+
+          ``'threads'``, ``'queue_wait'``: The number of threads the
+          solve was given from the thread budget, and the seconds it
+          waited for them; 0 if there is no budget (see
+          :func:`setThreadBudget`).
+
+        Example::
+
+          >>> m.solve(x.sum(), time_limit = 2)
+          41.0
+          >>> m.getSolveInfo()['status']
+          'feasible'
+        """
+
+        self._checkOkay()
+
+        cdef SolveInfo info
+
+        with nogil:
+            self.model.getSolveInfo(&info)
+
+        return {"status"       : solve_outcome_names.get(info.outcome, "error"),
+                "objective"    : info.objective,
+                "best_bound"   : info.best_bound,
+                "gap"          : info.gap,
+                "nodes"        : info.nodes,
+                "cplex_status" : info.cplex_status,
+                "threads"      : info.threads,
+                "queue_wait"   : info.queue_wait}
+
     def getNIterations(self):
         """
         Returns the number of iterations made during the previous call
@@ -2203,11 +4092,99 @@ cdef class CPlexModel(object):
         """
 
         self._checkOkay()
-        
-        return self.model.getNIterations()
-        
 
-    cpdef value(self, var_block_or_expression):
+        cdef long n_iterations
+
+        with nogil:
+            n_iterations = self.model.getNIterations()
+
+        return n_iterations
+
+    def getEnvMemoryUsage(self):
+        """
+        Returns the memory, in bytes, currently held by the concert
+        environment of this model.  Expressions and constraints give
+        their memory back once nothing refers to them anymore, so
+        this should stay flat when parts of a model are repeatedly
+        rebuilt.
+        """
+
+        self._checkOkay()
+
+        cdef long memory_usage
+
+        with nogil:
+            memory_usage = self.model.getMemoryUsage()
+
+        return memory_usage
+
+    def stats(self):
+        """
+        Returns a dictionary of cumulative timings and counts for this
+        model, gathered since it was created or since the last call
+        to :meth:`resetStats`.
+
+        For each of the phases ``'build'`` (creating variables,
+        expressions and constraints), ``'constrain'`` (adding them,
+        or the objective, to the model), ``'extract'`` (handing the
+        model to CPlex), ``'solve'`` and ``'retrieve'`` (reading
+        values, duals, etc. back), there is an entry holding a
+        dictionary with the number of ``'calls'`` and the ``'wall'``
+        and ``'cpu'`` time, in seconds, spent in them.  CPU time is
+        that of the thread doing the work, except for ``'solve'``,
+        where it is that of the whole process, so as to include the
+        threads used by CPlex; while other models are being solved or
+        built at the same time, their work is counted there too.
+
+        Further entries give the number of ``'expressions_created'``,
+        the ``'terms_emitted'`` (elements of all those expressions),
+        the ``'constraints_added'`` to the model, the ``'det_ticks'``
+        and simplex ``'iterations'`` over all solves, and the time
+        solves spent waiting for threads, ``'queue_wait'``, in
+        seconds (see :func:`setThreadBudget`).
+
+        Only the work done inside the C++ layer is timed.  The cost
+        of collecting these is a few clock reads per operation, so
+        they are always on.
+        """
+
+        self._checkOkay()
+
+        cdef ModelStats st
+        cdef int i
+
+        self.env.copyStats(&st)
+
+        cdef dict ret = {}
+
+        for name, i in [("build", PHASE_BUILD), ("constrain", PHASE_CONSTRAIN),
+                        ("extract", PHASE_EXTRACT), ("solve", PHASE_SOLVE),
+                        ("retrieve", PHASE_RETRIEVE)]:
+            ret[name] = {"calls" : st.phases[i].calls,
+                         "wall"  : st.phases[i].wall_ns * 1e-9,
+                         "cpu"   : st.phases[i].cpu_ns * 1e-9}
+
+        ret["expressions_created"] = st.expressions_created
+        ret["terms_emitted"]       = st.terms_emitted
+        ret["constraints_added"]   = st.constraints_added
+        ret["det_ticks"]           = st.det_ticks
+        ret["iterations"]          = st.iterations
+        ret["queue_wait"]          = st.queue_wait_ns * 1e-9
+
+        return ret
+
+    def resetStats(self):
+        """
+        Sets all the timings and counts returned by :meth:`stats` back
+        to zero.
+        """
+
+        self._checkOkay()
+
+        with nogil:
+            self.env.resetStats()
+
+    cpdef value(self, var_block_or_expression, ar out = None):
         """
         Returns a scalar, numpy array, or matrix filled by the values
         of the variable block or expression.  Calling ``m.value(x)``
@@ -2223,6 +4200,16 @@ cdef class CPlexModel(object):
         scalars, vector values are returned as a 1d numpy array, and
         2d variable blocks are returned as 2d matrices.
 
+        If `out` is given, it must be a C-contiguous float64 array with
+        as many elements as the block; the values are written into it
+        in row-major order and `out` itself is returned.  This avoids
+        allocating a new array when the same values are read after
+        every solve.
+
+        Values of variables, and of slices of them, are taken from a
+        snapshot made once after each solve, so reading them is a
+        plain copy.
+
         Example::
 
           >>> from pycpx import CPlexModel
@@ -2279,44 +4266,144 @@ cdef class CPlexModel(object):
         
         # print "var_block size = ", (v.data.md().shape(0), v.data.md().shape(1))
 
-        M = matrix(empty( (v.data.md().shape(0), v.data.md().shape(1)) ) )
+        cdef long d_0 = v.data.md().shape(0), d_1 = v.data.md().shape(1)
+
+        if out is not None:
+            if out.dtype != float64 or not out.flags.c_contiguous:
+                raise TypeError("`out` must be a C-contiguous array of float64.")
 
-        # print "M.shape = ", M.shape
+            if out.size != d_0 * d_1:
+                raise ValueError("`out` has %d elements, needs %d." % (out.size, d_0 * d_1))
+
+            M = out.reshape( (d_0, d_1) )
+        else:
+            M = matrix(empty( (d_0, d_1) ) )
 
         cdef ar[double,ndim=2, mode = "c"] X = M
         
-        cdef NumericalArray *na = new NumericalArray(env, (<double*>(X.data)),
+        cdef NumericalArray *na = new NumericalArray(self.env[0], (<double*>(X.data)),
                 MetaData(v.data.md().mode(), v.data.md().shape(0), v.data.md().shape(1)))
 
         try:
-            s = self.model.getValues(na[0], v.data[0])
+            with nogil:
+                s = self.model.getValues(na[0], v.data[0])
 
             if s.error_code != 0:
                 raise CPlexException("Error while retrieving variables: %s" % s.message)
 
-            size = v.original_size
+            if out is not None:
+                return out
 
-            if size == s_scalar:
-                assert X.shape[0] == X.shape[1] == 1
-                return M[0,0]
+            return shapedLikeBlock(v, M)
+            
+        finally:
+            del na
 
-            elif (type(size) is tuple and len(<tuple>size) == 2):
-                return M
+    def reduced_cost(self, var_block):
+        """
+        Returns the reduced costs of the variables in `var_block` from
+        the last solve, shaped as :meth:`value` would return the
+        variables themselves.  `var_block` may be a variable block
+        returned by :meth:`new` or a slice of one, but not a general
+        expression.  Only available after a linear program has been
+        solved.
+        """
+
+        self._checkOkay()
+
+        if type(var_block) is not CPlexExpression:
+            raise TypeError("Can only retrieve reduced costs of variables.")
+
+        cdef CPlexExpression v = (<CPlexExpression>var_block)
+
+        if v.model is not self:
+            raise ValueError("Can only retrieve variables from the model in which they were created.")
+
+        cdef long d_0 = v.data.md().shape(0), d_1 = v.data.md().shape(1)
+
+        M = matrix(empty( (d_0, d_1) ) )
+
+        cdef ar[double,ndim=2, mode = "c"] X = M
+        cdef NumericalArray *na = new NumericalArray(self.env[0], (<double*>(X.data)),
+                                                     MetaData(v.data.md().mode(), d_0, d_1))
+        cdef Status s
+
+        with nogil:
+            s = self.model.getReducedCosts(na[0], v.data[0])
+            del na
+
+        if s.error_code != 0:
+            raise CPlexException("Error retrieving reduced costs: %s" % s.message)
+
+        return shapedLikeBlock(v, M)
+
+    def dual(self, constraint):
+        """
+        Returns the dual values of the constraints in `constraint`,
+        as returned by a comparison such as ``A*x <= b``, from the last
+        solve.  The result has the shape of the constraint block, as a
+        1d array if the block is a vector.  Only available for linear
+        constraints after a linear program has been solved.
+
+        Example::
+
+          >>> m = CPlexModel()
+          >>> x = m.new(2, lb = 0)
+          >>> c = (x <= array([1, 2]))
+          >>> m.constrain(c)
+          >>> m.maximize(x.sum())
+          3.0
+          >>> m.dual(c)
+          array([ 1.,  1.])
+        """
+
+        return self._constraintValues(constraint, True)
+
+    def slack(self, constraint):
+        """
+        Returns the slacks of the constraints in `constraint` from the
+        last solve, in the same form as :meth:`dual`.  The slack of a
+        constraint is the distance of its expression from the bound,
+        as defined by CPlex.
+        """
+
+        return self._constraintValues(constraint, False)
+
+    cdef _constraintValues(self, constraint, bint duals):
+
+        self._checkOkay()
+
+        if type(constraint) is not CPlexConstraint:
+            raise TypeError("Expected constraint, got %s." % repr(type(constraint)))
+
+        cdef CPlexConstraint c = (<CPlexConstraint>constraint)
 
-            elif (type(size) is tuple and len(<tuple>size) == 1):
-                assert X.shape[0] == size[0]
-                return asarray(M).ravel()
+        if c.model is not self:
+            raise ValueError("Constraint not from this model.")
 
-            elif isscalar(size):
-                assert X.shape[0] == size and X.shape[1] == 1
-                return asarray(M).ravel()
+        cdef long d_0 = c.data.md().shape(0), d_1 = c.data.md().shape(1)
+        cdef ar[double,ndim=2, mode = "c"] X = empty( (d_0, d_1) )
+        cdef NumericalArray *na = new NumericalArray(self.env[0], (<double*>(X.data)),
+                                                     MetaData(MATRIX_MODE, d_0, d_1))
+        cdef Status s
 
+        with nogil:
+            if duals:
+                s = self.model.getDuals(na[0], c.data[0])
             else:
-                return M
-            
-        finally:
+                s = self.model.getSlacks(na[0], c.data[0])
+
             del na
 
+        if s.error_code != 0:
+            raise CPlexException("Error retrieving %s: %s"
+                                 % ("duals" if duals else "slacks", s.message))
+
+        if d_0 == 1 or d_1 == 1:
+            return X.ravel()
+        else:
+            return X
+
     cpdef asString(self):
         """
         Returns a string representation of the model.  If the
@@ -2377,11 +4464,131 @@ cdef class CPlexModel(object):
 
 
         self._checkOkay()
-        
-        return self.model.asString().c_str()
+
+        cdef string model_string
+
+        with nogil:
+            model_string = self.model.asString()
+
+        return model_string.c_str()
 
     def __repr__(self):
         return self.asString()
 
     def __getitem__(self, var_block):
         return self.value(var_block)
+
+
+################################################################################
+# Batches of constraint changes
+
+class ConstraintBatch(object):
+    """
+    The context manager returned by :meth:`CPlexModel.batch`.  After
+    the ``with`` block, `rows` holds the number of constraints added
+    or removed when it ended, and `flush_time` the seconds that took;
+    if a run of changes failed, only those made before it are
+    counted.
+    """
+
+    def __init__(self, CPlexModel model):
+        self.model = model
+        self.rows = 0
+        self.flush_time = 0.0
+
+    def __enter__(self):
+        self.model._beginBatch()
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.model._endBatch(self, exc_type is None)
+        return False
+
+
+################################################################################
+# Asynchronous solves
+
+cdef class _SolveAborter(object):
+    cdef SolveAborter *ptr
+
+    def __cinit__(self):
+        self.ptr = new SolveAborter()
+
+    def __dealloc__(self):
+        del self.ptr
+
+    def abort(self):
+        with nogil:
+            self.ptr.abort()
+
+    def abortRequested(self):
+        return self.ptr.abortRequested()
+
+cdef int _separateLazy(void* handler, double* values, long n,
+                       LazySeparatorI* separator) with gil:
+    # Called by LazySeparatorI for each candidate solution
+
+    return (<CPlexModel>handler)._separate(values, n, separator)
+
+def _runSolveFuture(future, CPlexModel model, objective, dict options):
+
+    if not future.set_running_or_notify_cancel():
+        return
+
+    cdef _SolveAborter aborter = future._aborter
+
+    value, error = None, None
+
+    try:
+        value = model._solveWithControl(aborter, objective, options)
+    except BaseException, e:
+        error = e
+
+    with future._finish_lock:
+        future._finished = True
+
+    if error is not None:
+        future.set_exception(error)
+    else:
+        future.set_result(value)
+
+class SolveFuture(_FutureBase):
+    """
+    The result of :meth:`CPlexModel.solve_async`.  This is a
+    ``concurrent.futures.Future``, so ``result()``, ``done()``,
+    ``add_done_callback()`` and ``asyncio.wrap_future`` all work as
+    usual.  As with any future, ``cancel()`` only succeeds before the
+    solve has started; a running solve is stopped with :meth:`abort`.
+    """
+
+    def __init__(self, CPlexModel model, objective, dict options):
+        _FutureBase.__init__(self)
+
+        self._aborter = _SolveAborter()
+        self._finish_lock = threading.Lock()
+        self._finished = False
+
+        thread = threading.Thread(target = _runSolveFuture,
+                                  args = (self, model, objective, options))
+        thread.daemon = True
+        thread.start()
+
+    def abort(self):
+        """
+        Stops the solve.  If it has not started yet, it is cancelled as
+        by ``cancel()``.  If it is running, CPlex is told to stop, and
+        ``result()`` raises :class:`CPlexException` once it has, unless
+        the solve finished first; the future is then done, but not
+        cancelled.  Returns False if the solve had already finished.
+        """
+
+        if self.cancel():
+            return True
+
+        with self._finish_lock:
+            if self._finished:
+                return False
+
+            self._aborter.abort()
+
+        return True
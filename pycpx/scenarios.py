@@ -0,0 +1,168 @@
+"""
+Solving many scenarios of one model in a pool of worker processes.
+
+Building a model happens largely in python, so one process can only
+build and solve so many small models at a time.  Here each worker
+process builds its own copy of the model once, then solves a share of
+the scenarios with :meth:`CPlexModel.solve_batch`, writing the results
+straight into arrays in shared memory.
+"""
+
+import multiprocessing
+from multiprocessing.sharedctypes import RawArray
+from numpy import frombuffer, asarray, float64
+
+# Set up in each worker by _initWorker
+_worker = None
+
+def _sharedArray(shape):
+    n = 1
+    for d in shape:
+        n *= d
+
+    raw = RawArray('d', max(n, 1))
+    return raw, frombuffer(raw, dtype = float64, count = n).reshape(shape)
+
+def _sharedCopy(X):
+    if X is None:
+        return None, None
+
+    raw, S = _sharedArray(X.shape)
+    S[...] = X
+    return raw, X.shape
+
+def _view(raw, shape):
+    if raw is None:
+        return None
+
+    n = 1
+    for d in shape:
+        n *= d
+
+    return frombuffer(raw, dtype = float64, count = n).reshape(shape)
+
+def _initWorker(build, args, threads, shared):
+    global _worker
+
+    model, batch = build(*args)
+    model.setParameter("Threads", threads)
+
+    _worker = (model, batch, [_view(raw, shape) for raw, shape in shared])
+
+def _solveChunk(bounds):
+    start, stop = bounds
+    model, batch, (objectives, rhs, objective_values, values) = _worker
+
+    options = dict(batch)
+
+    if objectives is not None:
+        options["objectives"] = objectives[start:stop]
+
+    if rhs is not None:
+        options["rhs"] = rhs[start:stop]
+
+    obj, V = model.solve_batch(**options)
+
+    objective_values[start:stop] = obj
+
+    if V is None:
+        return None
+
+    values[start:stop] = V.reshape(stop - start, -1)
+    return V.shape[1:]
+
+def solve_scenarios(build, objectives = None, rhs = None, args = (),
+                    processes = None, chunk_size = None, threads = 1):
+    """
+    Solves the scenarios given by the rows of `objectives` and `rhs`
+    in a pool of `processes` worker processes (by default, one per
+    core) and returns a tuple ``(objective_values, solutions)`` as
+    :meth:`CPlexModel.solve_batch` does.
+
+    `build` is called as ``build(*args)`` once in each worker, and
+    must return a tuple ``(model, options)``, where `model` is a
+    :class:`CPlexModel` and `options` is a dictionary of the other
+    arguments to :meth:`CPlexModel.solve_batch` (``'objective'``,
+    ``'variables'``, ``'constraint'``, ``'values'``, ``'maximize'``
+    or ``'minimize'``).  It is also called once in this process
+    first, to check that it works and to find the shape of the
+    solutions.  Where processes are not started by forking, `build` and `args`
+    must be picklable.
+
+    Each worker solves chunks of `chunk_size` consecutive scenarios
+    with :meth:`CPlexModel.solve_batch`, so each solve starts from
+    the previous one, using `threads` solver threads.  The scenarios
+    and results are passed in shared memory; only the bounds of each
+    chunk go through the pool's pipes.
+
+    Example::
+
+      def build(n):
+          m = CPlexModel()
+          x = m.new(n, lb = 0, ub = 1)
+          c = (x.sum() <= 1)
+          m.constrain(c)
+          return m, {'objective' : x.sum(), 'variables' : x,
+                     'values' : x, 'maximize' : True}
+
+      obj, X = solve_scenarios(build, objectives = rn.rand(10000, 5), args = (5,))
+    """
+
+    # Errors in build would otherwise only show up in the workers
+    model, batch = build(*args)
+
+    if "objective" not in batch:
+        raise ValueError("The options returned by build must include the objective.")
+
+    C = None if objectives is None else asarray(objectives, dtype = float64)
+    B = None if rhs is None else asarray(rhs, dtype = float64)
+
+    if C is not None and C.ndim != 2:
+        raise ValueError("objectives must be a 2d array.")
+
+    if B is not None and B.ndim != 2:
+        raise ValueError("rhs must be a 2d array.")
+
+    if C is None and B is None:
+        raise ValueError("Either objectives or rhs must be given.")
+
+    if C is not None and B is not None and C.shape[0] != B.shape[0]:
+        raise ValueError("objectives and rhs must have the same number of rows.")
+
+    n = C.shape[0] if C is not None else B.shape[0]
+
+    values = batch.get("values")
+    n_values = 0 if values is None else values.size
+
+    if processes is None:
+        processes = multiprocessing.cpu_count()
+
+    if chunk_size is None:
+        chunk_size = max(1, (n + 4*processes - 1) // (4*processes))
+
+    raw_objectives, objectives_shape = _sharedCopy(C)
+    raw_rhs, rhs_shape = _sharedCopy(B)
+    raw_objective_values, objective_values = _sharedArray( (n,) )
+    raw_values, solutions = _sharedArray( (n, n_values) )
+
+    shared = [(raw_objectives, objectives_shape), (raw_rhs, rhs_shape),
+              (raw_objective_values, (n,)), (raw_values, (n, n_values))]
+
+    chunks = [(k, min(k + chunk_size, n)) for k in xrange(0, n, chunk_size)]
+
+    pool = multiprocessing.Pool(processes, _initWorker, (build, args, threads, shared))
+
+    try:
+        shapes = pool.map(_solveChunk, chunks, 1)
+    finally:
+        pool.close()
+        pool.join()
+
+    # Copied out, as the shared memory goes with this call
+    objective_values = objective_values.copy()
+
+    if values is None:
+        return (objective_values, None)
+
+    shape = (n,) + (shapes[0] if shapes else (values.shape[0], values.shape[1]))
+    return (objective_values, solutions.reshape(shape).copy())
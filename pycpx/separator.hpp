@@ -0,0 +1,101 @@
+#ifndef _SEPARATOR_HPP_
+#define _SEPARATOR_HPP_
+
+// Lazy constraint separation in python.  For each candidate solution,
+// the callback reads the values of the watched variables in one call
+// and hands them to a function supplied by the python side, which
+// passes the violated constraints back through addConstraints().  Only
+// one call of the function runs at a time, and it may build
+// expressions, as the solving thread lends it the environment (see
+// ModelEnv).
+
+#include <ilcplex/ilocplex.h>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "environment.hpp"
+#include "containers.hpp"
+
+using namespace std;
+
+class LazySeparatorI;
+
+// Returns nonzero to stop the solve
+typedef int (*SeparateFunction)(void* handler, const double* values, long n,
+				LazySeparatorI* separator);
+
+class LazySeparatorI : public IloCplex::LazyConstraintCallbackI {
+public:
+    LazySeparatorI(const ModelEnv& env, SeparateFunction function, void* handler,
+		   pthread_mutex_t* call_lock, const IloNumVarArray& vars)
+	: IloCplex::LazyConstraintCallbackI(env.env()), _env(env), _function(function),
+	  _handler(handler), _call_lock(call_lock), _vars(vars),
+	  _values(env.env(), vars.getSize()), _buffer(vars.getSize())
+	{
+	}
+
+    ~LazySeparatorI()
+	{
+	    _values.end();
+	}
+
+    // Each copy reads the values into its own arrays
+    IloCplex::CallbackI* duplicateCallback() const
+	{
+	    return new (getEnv()) LazySeparatorI(_env, _function, _handler, _call_lock, _vars);
+	}
+
+    void main()
+	{
+	    getValues(_values, _vars);
+
+	    for(long i = 0; i < long(_buffer.size()); ++i)
+		_buffer[i] = _values[i];
+
+	    int result;
+
+	    pthread_mutex_lock(_call_lock);
+
+	    {
+		CallbackEnvScope scope(_env);
+		result = _function(_handler, _buffer.empty() ? NULL : &_buffer[0],
+				   _buffer.size(), this);
+	    }
+
+	    pthread_mutex_unlock(_call_lock);
+
+	    if(result != 0)
+		abort();
+	}
+
+    // Adds every constraint in cstr as a lazy constraint.  Only to be
+    // called from the function, while main() runs.  Returns false and
+    // sets error if CPlex refuses one of them.
+    bool addConstraints(const ConstraintArray& cstr, string* error)
+	{
+	    EnvLock lock(_env);
+
+	    try {
+		for(long i = 0; i < cstr.shape(0); ++i)
+		    for(long j = 0; j < cstr.shape(1); ++j)
+			add(cstr(i,j));
+	    } catch(IloException& e) {
+		*error = e.getMessage();
+		return false;
+	    }
+
+	    return true;
+	}
+
+private:
+    ModelEnv _env;
+    SeparateFunction _function;
+    void* _handler;
+    pthread_mutex_t* _call_lock;
+    IloNumVarArray _vars;
+    IloNumArray _values;
+    vector<double> _buffer;
+};
+
+#endif /* _SEPARATOR_HPP_ */
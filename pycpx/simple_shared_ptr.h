@@ -1,6 +1,9 @@
 #ifndef _SIMPLE_SHARED_PTR_H_
 #define _SIMPLE_SHARED_PTR_H_
 
+// The reference count is updated atomically, as references may be
+// taken and dropped from threads running without the GIL.
+
 template <typename T> class SharedPointer 
 {
 private:
@@ -9,7 +12,7 @@ private:
 
     inline void decRef()
     {
-	if( --(*_ref_count) == 0)
+	if(__sync_sub_and_fetch(_ref_count, 1) == 0)
 	{
 	    if(_data != NULL)
 		delete _data;
@@ -34,7 +37,7 @@ public:
     SharedPointer(const SharedPointer<T>& sp) 
     : _data(sp._data), _ref_count(sp._ref_count)
     {
-	++(*_ref_count);
+	__sync_add_and_fetch(_ref_count, 1);
     }
     
     ~SharedPointer()
@@ -53,7 +56,7 @@ public:
 
 	    _data = sp._data;
 	    _ref_count = sp._ref_count;
-	    ++(*_ref_count);
+	    __sync_add_and_fetch(_ref_count, 1);
 	}
 	return *this;
     }
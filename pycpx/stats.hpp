@@ -0,0 +1,85 @@
+#ifndef _STATS_HPP_
+#define _STATS_HPP_
+
+// Cumulative timings and counts for a model, kept with its
+// environment so that the expression and constraint operators, which
+// only see the environment, can record them too.  Everything is
+// updated with atomic adds, as several threads may be building parts
+// of the same model at once.
+
+#include <time.h>
+#include <string.h>
+
+#define PHASE_BUILD      0
+#define PHASE_CONSTRAIN  1
+#define PHASE_EXTRACT    2
+#define PHASE_SOLVE      3
+#define PHASE_RETRIEVE   4
+#define N_PHASES         5
+
+struct PhaseStats {
+    long long calls;
+    long long wall_ns;
+    long long cpu_ns;
+};
+
+struct ModelStats {
+    PhaseStats phases[N_PHASES];
+
+    long long expressions_created;
+    long long terms_emitted;
+    long long constraints_added;
+    long long iterations;
+    long long queue_wait_ns;
+
+    // Only updated while solving, under the environment lock
+    double det_ticks;
+};
+
+inline long long clockNanoseconds(clockid_t clock)
+{
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return (long long)(t.tv_sec) * 1000000000LL + t.tv_nsec;
+}
+
+inline void clearStats(ModelStats& stats)
+{
+    memset(&stats, 0, sizeof(ModelStats));
+}
+
+inline void countStat(long long& counter, long long n)
+{
+    __sync_add_and_fetch(&counter, n);
+}
+
+// Adds the wall and CPU time of its lifetime to one phase.  The CPU
+// time is that of the calling thread, so that models used from
+// different threads are not charged for each other's work, except
+// for the solve phase: CPlex solves on threads of its own, so there
+// it is that of the whole process.
+class PhaseTimer {
+public:
+    PhaseTimer(ModelStats& stats, int phase)
+	: _phase(stats.phases[phase]),
+	  _cpu_clock(phase == PHASE_SOLVE ? CLOCK_PROCESS_CPUTIME_ID : CLOCK_THREAD_CPUTIME_ID),
+	  _wall_start(clockNanoseconds(CLOCK_MONOTONIC)),
+	  _cpu_start(clockNanoseconds(_cpu_clock))
+	{
+	}
+
+    ~PhaseTimer()
+	{
+	    countStat(_phase.calls, 1);
+	    countStat(_phase.wall_ns, clockNanoseconds(CLOCK_MONOTONIC) - _wall_start);
+	    countStat(_phase.cpu_ns, clockNanoseconds(_cpu_clock) - _cpu_start);
+	}
+
+private:
+    PhaseStats& _phase;
+    clockid_t _cpu_clock;
+    long long _wall_start;
+    long long _cpu_start;
+};
+
+#endif /* _STATS_HPP_ */
@@ -0,0 +1,192 @@
+#ifndef _THREAD_BUDGET_HPP_
+#define _THREAD_BUDGET_HPP_
+
+// A process wide budget of solver threads shared by all models.  Once
+// a budget is set, every solve asks it for threads before starting;
+// it gets the number of threads it asked for (its Threads parameter,
+// or the budget's default if that is 0) or what is left, if less, and
+// solves with that many.  When nothing is left, solves queue up and
+// start in the order they arrived as threads are given back.  Without
+// a budget, solves start immediately with their own Threads setting.
+
+#include <list>
+#include <pthread.h>
+#include <time.h>
+
+#include "stats.hpp"
+
+using namespace std;
+
+struct ThreadBudgetState {
+    long total;
+    long default_request;
+    long in_use;
+    long queued;
+    long long solves;
+    double wait_seconds;
+};
+
+class ThreadBudget {
+public:
+    static ThreadBudget& global()
+	{
+	    static ThreadBudget budget;
+	    return budget;
+	}
+
+    // A total of 0 turns the budget off
+    void configure(long total, long default_request)
+	{
+	    pthread_mutex_lock(&_lock);
+	    _total = total;
+	    _default_request = default_request;
+	    pthread_cond_broadcast(&_changed);
+	    pthread_mutex_unlock(&_lock);
+	}
+
+    bool enabled() const
+	{
+	    return _total > 0;
+	}
+
+    // Waits for threads for a solve asking for requested of them.
+    // Returns the number of threads granted, or 0 if *stop was set
+    // while waiting; wait_ns gets the time spent in the queue.
+    long acquire(long requested, const volatile bool* stop, long long* wait_ns)
+	{
+	    long long start = clockNanoseconds(CLOCK_MONOTONIC);
+
+	    pthread_mutex_lock(&_lock);
+
+	    long ticket = _next_ticket++;
+	    _queue.push_back(ticket);
+
+	    while(_queue.front() != ticket || (_total > 0 && _in_use >= _total)) {
+		if(stop != NULL && *stop) {
+		    _queue.remove(ticket);
+		    pthread_cond_broadcast(&_changed);
+		    pthread_mutex_unlock(&_lock);
+
+		    *wait_ns = clockNanoseconds(CLOCK_MONOTONIC) - start;
+		    return 0;
+		}
+
+		// Wake up now and then to see whether the solve was aborted
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += 50000000;
+		if(until.tv_nsec >= 1000000000) {
+		    until.tv_sec += 1;
+		    until.tv_nsec -= 1000000000;
+		}
+
+		pthread_cond_timedwait(&_changed, &_lock, &until);
+	    }
+
+	    _queue.pop_front();
+
+	    if(requested <= 0)
+		requested = _default_request;
+
+	    long granted = requested;
+
+	    // The budget may have been turned off while waiting
+	    if(_total > 0 && granted > _total - _in_use)
+		granted = _total - _in_use;
+
+	    _in_use += granted;
+
+	    *wait_ns = clockNanoseconds(CLOCK_MONOTONIC) - start;
+	    ++_solves;
+	    _wait_ns += *wait_ns;
+
+	    pthread_cond_broadcast(&_changed);
+	    pthread_mutex_unlock(&_lock);
+
+	    return granted;
+	}
+
+    void release(long n)
+	{
+	    pthread_mutex_lock(&_lock);
+	    _in_use -= n;
+	    pthread_cond_broadcast(&_changed);
+	    pthread_mutex_unlock(&_lock);
+	}
+
+    void getState(ThreadBudgetState* dest)
+	{
+	    pthread_mutex_lock(&_lock);
+	    dest->total = _total;
+	    dest->default_request = _default_request;
+	    dest->in_use = _in_use;
+	    dest->queued = _queue.size();
+	    dest->solves = _solves;
+	    dest->wait_seconds = _wait_ns * 1e-9;
+	    pthread_mutex_unlock(&_lock);
+	}
+
+private:
+    ThreadBudget()
+	: _total(0), _default_request(1), _in_use(0), _next_ticket(0), _solves(0), _wait_ns(0)
+	{
+	    pthread_mutex_init(&_lock, NULL);
+	    pthread_cond_init(&_changed, NULL);
+	}
+
+    pthread_mutex_t _lock;
+    pthread_cond_t _changed;
+
+    volatile long _total;
+    long _default_request;
+    long _in_use;
+
+    long _next_ticket;
+    list<long> _queue;
+
+    long long _solves;
+    long long _wait_ns;
+};
+
+// Holds the threads granted to one solve and gives them back when it
+// goes out of scope.
+class ThreadGrant {
+public:
+    ThreadGrant()
+	: _threads(0), _wait_ns(0)
+	{
+	}
+
+    ~ThreadGrant()
+	{
+	    if(_threads > 0)
+		ThreadBudget::global().release(_threads);
+	}
+
+    // Returns false if stopped while waiting
+    bool acquire(long requested, const volatile bool* stop)
+	{
+	    _threads = ThreadBudget::global().acquire(requested, stop, &_wait_ns);
+	    return _threads > 0;
+	}
+
+    long threads() const { return _threads; }
+
+    long long waitNanoseconds() const { return _wait_ns; }
+
+private:
+    long _threads;
+    long long _wait_ns;
+};
+
+inline void setThreadBudget(long total, long default_request)
+{
+    ThreadBudget::global().configure(total, default_request);
+}
+
+inline void getThreadBudgetState(ThreadBudgetState* dest)
+{
+    ThreadBudget::global().getState(dest);
+}
+
+#endif /* _THREAD_BUDGET_HPP_ */
@@ -1,5 +1,19 @@
 from common import *
-import tempfile, os
+import tempfile, os, gc, threading, time
+
+try:
+    import concurrent.futures
+    have_futures = True
+except ImportError:
+    have_futures = False
+
+def _buildScenarioModel(n):
+    m = CPlexModel()
+    x = m.new(n, lb = 0, ub = 1)
+    c = (x.sum() <= 1)
+    m.constrain(c)
+    return m, {'objective' : x.sum(), 'variables' : x, 'values' : x,
+               'constraint' : c, 'maximize' : True}
 
 class TestBasic(unittest.TestCase):
 
@@ -446,11 +460,943 @@ class TestBasic(unittest.TestCase):
         m.constrain(x >= 12)
 
         self.assertRaises(CPlexNoSolution, lambda: m.maximize(x))
-        
 
-        
+    def test22_env_memory_flat(self):
+
+        m = CPlexModel()
+
+        N = 50
+        x = m.new(N, lb = 0, ub = 1)
+        A = rn.normal( size = (N/2, N) )
+        b = rn.normal( size = N/2 )
+
+        def rebuild():
+            c = (abs(A*x - b) <= 1)
+            m.constrain(c)
+            m.maximize(x.sum() - abs(x - 0.5).sum())
+            m.removeConstraint(c)
+
+        for i in range(5):
+            rebuild()
+
+        base = m.getEnvMemoryUsage()
+
+        for i in range(100):
+            rebuild()
+
+        self.assert_(m.getEnvMemoryUsage() <= 1.1*base,
+                     "env memory grew from %d to %d" % (base, m.getEnvMemoryUsage()))
+
+    def test23_independent_models(self):
+
+        m1 = CPlexModel()
+        x1 = m1.new(100, lb = 0, ub = 1)
+        m1.constrain(rn.normal(size = (50, 100)) * x1 <= 1)
+
+        m2 = CPlexModel()
+        x2 = m2.new(lb = 0, ub = 2)
+
+        self.assertRaises(ValueError, lambda: x1[0] + x2)
+        self.assert_(m2.getEnvMemoryUsage() < m1.getEnvMemoryUsage())
+
+        m1.maximize(x1.sum())
+        del m1, x1
+        gc.collect()
+
+        self.assertEqual(m2.maximize(x2), 2)
+
+    def test24_threaded_models(self):
+
+        N = 40
+        results = [None]*4
+
+        def run(k):
+            m = CPlexModel()
+            x = m.new(N, lb = 0, ub = k + 1)
+            m.constrain(rn.normal(size = (N/2, N)) * x <= 100)
+            m.constrain(x.sum() <= k + 1)
+            results[k] = m.maximize(x.sum())
+
+        threads = [threading.Thread(target = run, args = (k,)) for k in range(4)]
+
+        for t in threads:
+            t.start()
+
+        for t in threads:
+            t.join()
+
+        for k in range(4):
+            self.assertAlmostEqual(results[k], k + 1)
+
+    def test25_threaded_expressions(self):
+
+        m = CPlexModel()
+        x = m.new(50, lb = 0, ub = 1)
+        A = rn.normal(size = (20, 50))
+        constraints = []
+
+        def build():
+            for i in range(20):
+                constraints.append(abs(A*x) <= 10)
+
+        threads = [threading.Thread(target = build) for k in range(4)]
+
+        for t in threads:
+            t.start()
+
+        for t in threads:
+            t.join()
+
+        m.constrain(*constraints)
+        self.assertAlmostEqual(m.maximize(x.sum()), m[x].sum())
+
+    @unittest.skipIf(not have_futures, "requires concurrent.futures")
+    def test26_solve_async(self):
+        m = CPlexModel()
+        x = m.new(3, lb = 0, ub = 4)
+        m.constrain(x.sum() <= 10)
+
+        f = m.solve_async(x.sum(), maximize = True)
+
+        self.assertEqual(f.result(timeout = 60), 10)
+        self.assert_(f.done())
+        self.assertEqual(m[x].sum(), 10)
+        self.assert_(not f.cancel())
+        self.assert_(not f.abort())
+
+    @unittest.skipIf(not have_futures, "requires concurrent.futures")
+    def test27_solve_async_abort(self):
+        m = CPlexModel()
+
+        N = 200
+        x = m.new(N, vtype = 'bool')
+        m.constrain(rn.uniform(size = (N/4, N)) * x <= rn.uniform(N/16, N/8, size = N/4))
+
+        f = m.solve_async(rn.uniform(size = N) * x, maximize = True)
+        f.abort()
+
+        try:
+            f.result(timeout = 60)
+        except (CPlexException, concurrent.futures.CancelledError):
+            pass
+
+        self.assert_(f.done())
+
+        # A stopped solve doesn't affect later ones
+        y = m.new(lb = 0, ub = 2)
+        self.assertEqual(m.maximize(y), 2)
+
+    def test28_basis_snapshot(self):
+        m = CPlexModel()
+
+        N = 20
+        x = m.new(N, lb = 0, ub = 1)
+        A = rn.uniform(size = (N/2, N))
+        m.constrain(A * x <= 1)
+
+        c = rn.uniform(size = N)
+        v1 = m.maximize(c * x)
+
+        var_status, cstr_status = m.getBasis()
+        self.assertEqual(var_status.shape, (N,))
+        self.assertEqual(cstr_status.shape, (N/2,))
+
+        m.maximize(x.sum())
+
+        m.setBasis(var_status, cstr_status)
+        self.assertAlmostEqual(m.maximize(c * x, recycle_basis = False), v1)
+
+        self.assertRaises(CPlexException, lambda: m.setBasis(var_status[1:], cstr_status))
+
+    def test29_value_out(self):
+        m = CPlexModel()
+
+        N = 1000
+        x = m.new(N, lb = 0, ub = arange(N))
+        X = m.new( (10, 20), lb = -1, ub = 1)
+        m.maximize(x.sum() + X.sum())
+
+        self.assert_((m[x] == arange(N)).all())
+        self.assert_((m[x[10:20]] == arange(10, 20)).all())
+        self.assert_((m[X.T] == 1).all())
+
+        out = empty(N)
+        self.assert_(m.value(x, out = out) is out)
+        self.assert_((out == arange(N)).all())
+
+        self.assertRaises(ValueError, lambda: m.value(x, out = empty(N + 1)))
+        self.assertRaises(TypeError, lambda: m.value(x, out = empty(N, dtype = int32)))
+
+    def test30_duals_slacks(self):
+        m = CPlexModel()
+
+        x = m.new(3, lb = 0)
+        c = (x <= ar([1, 2, 3]))
+        d = (x.sum() <= 4)
+        m.constrain(c, d)
+
+        self.assertEqual(m.maximize(ar([3, 2, 1]) * x), 8)
+
+        self.assert_((m.slack(c) == ar([0, 0, 2])).all())
+        self.assert_((m.dual(c) == ar([2, 1, 0])).all())
+        self.assertEqual(m.dual(d).shape, (1,))
+        self.assertEqual(m.dual(d)[0], 1)
+        self.assertEqual(m.slack(d)[0], 0)
+        self.assert_((m.reduced_cost(x) == 0).all())
+        self.assertEqual(m.reduced_cost(x).shape, (3,))
+
+        self.assertRaises(CPlexException, lambda: m.reduced_cost(2*x))
+
+    def test31_mip_starts(self):
+        m = CPlexModel()
+
+        N = 30
+        x = m.new(N, vtype = 'bool')
+        y = m.new(N, vtype = 'int', lb = 0, ub = 3)
+        w = rn.uniform(size = N)
+        m.constrain(w * x + w * y <= 5)
+
+        starts = [{x : zeros(N), y : zeros(N)},
+                  {x : ones(N), y : zeros(N)},
+                  {x[:5] : ones(5)}]
+
+        v = m.maximize(x.sum() + y.sum(), mip_starts = starts, mip_start_effort = 'repair')
+        self.assert_(v >= 0)
+
+        m.clearMIPStarts()
+        self.assertEqual(m.maximize(x.sum() + y.sum()), v)
+
+        self.assertRaises(ValueError, lambda: m.addMIPStarts({x : zeros(N)}, effort = 'bogus'))
+        self.assertRaises(CPlexException, lambda: m.addMIPStarts({2*x : zeros(N)}))
+
+    def test32_recycle_variables(self):
+        m = CPlexModel()
+
+        N = 20
+        x = m.new(N, vtype = 'int', lb = 0, ub = 5)
+        m.constrain(rn.uniform(size = N) * x <= 10)
+
+        c = rn.uniform(size = N)
+        v = m.maximize(c * x)
+        x_1 = m[x]
+
+        y = m.new(lb = 0, ub = 1)
+
+        self.assertAlmostEqual(m.maximize(c * x + y, recycle_variables = True), v + 1)
+        self.assertAlmostEqual(m.maximize(c * x, recycle_variables = True), v)
+        self.assertAlmostEqual((c * m[x]).sum(), (c * x_1).sum())
+
+    def test33_parameters(self):
+        m = CPlexModel()
+
+        m.setParameter('Threads', 2)
+        m.setParameter('workmem', 512.0)
+        m.setParameter('PreInd', False)
+        m.setParameter('WorkDir', tempfile.gettempdir())
+
+        self.assertEqual(m.getParameter('threads'), 2)
+        self.assertEqual(m.getParameter('WorkMem'), 512)
+        self.assertEqual(m.getParameter('PreInd'), False)
+        self.assertEqual(m.getParameter('WorkDir'), tempfile.gettempdir())
+
+        self.assertRaises(ValueError, lambda: m.setParameter('NoSuchParameter', 1))
+        self.assertRaises(TypeError, lambda: m.setParameter('Threads', 1.5))
+        self.assertRaises(TypeError, lambda: m.setParameter('WorkDir', 1))
+
+        self.assert_('DetTiLim' in m.getParameterNames())
+
+        # Solving only sets RootAlg when asked to
+        x = m.new(lb = 0, ub = 1)
+        m.setParameter('RootAlg', 2)
+        m.maximize(x)
+        self.assertEqual(m.getParameter('RootAlg'), 2)
+
+        m.maximize(x, algorithm = 'primal')
+        self.assertEqual(m.getParameter('RootAlg'), 1)
+
+        self.assertRaises(ValueError, lambda: m.maximize(x, algorithm = 'nosuch'))
+
+        f, filename = tempfile.mkstemp(suffix = '.prm')
+        os.close(f)
+
+        try:
+            m.writeParameters(filename)
+
+            m2 = CPlexModel()
+            m2.readParameters(filename)
+            self.assertEqual(m2.getParameter('Threads'), 2)
+            self.assertEqual(m2.getParameter('WorkMem'), 512)
+
+            m2.resetParameters()
+            self.assertEqual(m2.getParameter('Threads'), 0)
+        finally:
+            os.remove(filename)
+
+    def test34_progress(self):
+        m = CPlexModel()
+
+        N = 50
+        x = m.new(N, vtype = 'int', lb = 0, ub = 10)
+        m.constrain(rn.uniform(size = (10, N)) * x <= 20)
+        c = rn.uniform(size = N)
+
+        self.assertEqual(len(m.getProgress()), 0)
+        self.assert_(m.getIncumbent() is None)
+
+        m.monitorProgress(capacity = 16, copy_incumbent = True)
+        v = m.maximize(c * x)
+
+        p = m.getProgress()
+        self.assertEqual(p.dtype.names,
+                         ('time', 'det_time', 'best_bound', 'incumbent', 'gap', 'nodes'))
+        self.assert_(len(p) <= 16)
+        self.assert_((p['time'] >= 0).all())
+        self.assertEqual(len(m.getProgress()), 0)
+
+        inc = m.getIncumbent()
+
+        if inc is not None:
+            self.assertEqual(inc[1].shape, (N,))
+            self.assert_(inc[0] <= v + 1e-6)
+
+        m.monitorProgress(False)
+        m.maximize(c * x)
+        self.assertEqual(len(m.getProgress()), 0)
+
+        self.assertRaises(ValueError, lambda: m.monitorProgress(capacity = 0))
+
+    def test35_stats(self):
+        m = CPlexModel()
+
+        x = m.new(10, lb = 0, ub = 1)
+        y = m.new(10, lb = 0, ub = 1)
+        m.constrain(x + y <= 1)
+        m.maximize((2*x + y).sum())
+        m[x]
+
+        st = m.stats()
+
+        for phase in ["build", "constrain", "extract", "solve", "retrieve"]:
+            self.assert_(st[phase]["calls"] >= 1, phase)
+            self.assert_(st[phase]["wall"] >= 0, phase)
+            self.assert_(st[phase]["cpu"] >= 0, phase)
+
+        self.assertEqual(st["extract"]["calls"], 1)
+        self.assertEqual(st["solve"]["calls"], 1)
+        self.assertEqual(st["constraints_added"], 10)
+        self.assert_(st["expressions_created"] >= 5)
+        self.assert_(st["terms_emitted"] >= 30)
+        self.assert_(st["det_ticks"] >= 0)
+
+        m.resetStats()
+        self.assertEqual(m.stats()["solve"]["calls"], 0)
+        self.assertEqual(m.stats()["constraints_added"], 0)
+
+    def test36_write_read(self):
+        m = CPlexModel()
+
+        A = ar([[1,0,0], [1,1,0], [1,1,1]])
+        b = ar([1,2,3])
+
+        # Distinct bounds, so that misplaced variables show up
+        U = ar([[1, 0, 1], [1, 0, 1]])
+
+        x = m.new(3, lb = 0, name = 'x')
+        X = m.new((2, 3), lb = 0, ub = U, vtype = 'int')
+        t = m.new(ub = 4)
+        m.constrain(A*x <= b, X.sum() <= t)
+
+        v = m.maximize(3*x[0] + 2*x[1] + x[2] + X.sum())
+        self.assertEqual(v, 10)
+
+        for suffix in ['', '.mps']:
+            f, filename = tempfile.mkstemp(suffix = suffix)
+            os.close(f)
+            os.remove(filename)
+
+            filename = m.write(filename)
+
+            try:
+                if suffix == '':
+                    self.assert_(filename.endswith('.sav'))
+
+                m2, variables = CPlexModel.read(filename)
+            finally:
+                os.remove(filename)
+
+            self.assertEqual(m2.solve(None), v)
+
+            x2 = variables['x']
+            X2 = variables['_2']
+            t2 = variables['_3']
+
+            self.assertEqual(x2.shape, (3, 1))
+            self.assertEqual(X2.shape, (2, 3))
+            self.assert_((m2[x2] == ar([1, 1, 1])).all())
+            self.assertEqual(m2[X2].shape, (2, 3))
+            self.assert_((m2[X2] == U).all())
+            self.assertEqual(m2[t2], 4)
+
+            self.assertEqual(m2.minimize(x2.sum()), 0)
+
+        self.assertRaises(CPlexException, lambda: CPlexModel.read('/nonexistent/model.sav'))
+
+    def test37_clone(self):
+        m = CPlexModel()
+
+        x = m.new(3, lb = 0, ub = 1, name = 'x')
+        y = m.new(lb = 0)
+        m.constrain(x.sum() <= 2, y <= x[0] + x[1])
+        self.assertEqual(m.maximize(x.sum() + y), 4)
+
+        m2 = m.clone()
+        x2 = m2.translate(x)
+        y2 = m2.translate(y)
+        m2.constrain(x2[0] == 0)
+
+        self.assertEqual(m2.maximize(x2.sum() + y2), 3)
+        self.assertEqual(m2[x2][0], 0)
+        self.assertEqual(m2[y2], 1)
+
+        # The original is unaffected
+        self.assertEqual(m.maximize(x.sum() + y), 4)
+        self.assertEqual(m[y], 2)
+
+        # Clones of clones, and expressions translated as well
+        m3 = m2.clone()
+        self.assertEqual(m3.maximize(m3.translate(x.sum() + y)), 3)
+
+        self.assertRaises(ValueError, lambda: CPlexModel().translate(x))
+
+    def test38_update_rhs_bounds(self):
+        m = CPlexModel()
+
+        A = ar([[1,0,0], [1,1,0], [1,1,1]])
+
+        x = m.new(3, lb = 0, ub = 10)
+        c = (A*x <= ar([1,2,3]))
+        d = (x[2] >= 0)
+        m.constrain(c, d)
+
+        self.assertEqual(m.maximize(x.sum()), 3)
 
+        m.update_rhs(c, ar([2,4,6]))
+        self.assertEqual(m.maximize(x.sum()), 6)
+
+        m.update_rhs(c, 5)
+        self.assertEqual(m.maximize(x.sum()), 5)
+
+        m.update_rhs(d, 1)
+        self.assertEqual(m.minimize(x[2]), 1)
+
+        m.update_bounds(x, ub = ar([1, 1, 1]))
+        self.assertEqual(m.maximize(x.sum()), 3)
+
+        m.update_bounds(x[:2], lb = 1, ub = nan)
+        self.assertEqual(m.minimize(x.sum()), 3)
+        self.assertEqual(m.maximize(x[0]), 4)
+
+        self.assertRaises(CPlexException, lambda: m.update_bounds(2*x, lb = 0))
+        self.assertRaises(IndexError, lambda: m.update_rhs(c, ar([1, 2])))
+
+    def test39_update_objective(self):
+        m = CPlexModel()
+
+        x = m.new(3, lb = 0, ub = 1)
+        y = m.new(lb = 0, ub = 2)
+        m.constrain(x.sum() + y <= 3)
+
+        obj = x.sum() + y
+        self.assertEqual(m.maximize(obj), 3)
+
+        m.update_objective(x, ar([1, 2, 3]))
+        self.assertEqual(m.maximize(obj), 6)
+        self.assertEqual(m[x][1], 1)
+        self.assertEqual(m[x][2], 1)
+
+        m.update_objective(x[0], 10)
+        self.assertEqual(m.maximize(obj), 15)
+
+        # The sense may change; the coefficients stay
+        self.assertEqual(m.minimize(obj), 0)
+        self.assertEqual(m.maximize(obj), 15)
+
+        # A new objective expression replaces the changed one
+        self.assertEqual(m.maximize(x.sum() + y), 3)
+
+        self.assertRaises(CPlexException, lambda: m.update_objective(2*x, 1))
+
+        m2 = CPlexModel()
+        z = m2.new(2)
+        self.assertRaises(CPlexException, lambda: m2.update_objective(z, 1))
+        self.assertRaises(ValueError, lambda: m2.update_objective(x, 1))
+
+    def test40_solve_batch(self):
+        m = CPlexModel()
+
+        x = m.new(3, lb = 0, ub = 1)
+        c = (x.sum() <= 2)
+        m.constrain(c)
+
+        C = ar([[1, 2, 3], [3, 2, 1], [1, 1, -1]])
+        obj, X = m.solve_batch(x.sum(), objectives = C, variables = x, values = x)
+
+        self.assert_((obj == ar([5, 5, 2])).all())
+        self.assertEqual(X.shape, (3, 3))
+        self.assert_((X[0] == ar([0, 1, 1])).all())
+        self.assert_((X[1] == ar([1, 1, 0])).all())
+        self.assert_((X[2] == ar([1, 1, 0])).all())
+
+        B = ar([[1], [3], [-1]])
+        obj, X = m.solve_batch(x.sum(), rhs = B, constraint = c)
+
+        self.assert_(X is None)
+        self.assertEqual(obj[0], 1)
+        self.assertEqual(obj[1], 3)
+        self.assert_(isnan(obj[2]))
+
+        # The infeasible last scenario leaves the model unsolved
+        self.assertRaises(CPlexException, m.getBasis)
+
+        # Both at once, with a matrix block
+        m.update_rhs(c, 2)
+
+        Y = m.new((2, 2), lb = 0, ub = 1)
+        d = (Y.sum() <= 1)
+        m.constrain(d)
+
+        obj, V = m.solve_batch(Y.sum(), objectives = ar([[1, 2, 3, 4], [4, 3, 2, 1]]),
+                               variables = Y, rhs = ar([[1], [0]]), constraint = d,
+                               values = Y)
+
+        self.assert_((obj == ar([4, 0])).all())
+        self.assertEqual(V.shape, (2, 2, 2))
+        self.assertEqual(V[0,1,1], 1)
+
+        self.assertRaises(ValueError, lambda: m.solve_batch(x.sum()))
+        self.assertRaises(ValueError, lambda: m.solve_batch(x.sum(), objectives = ar([[1, 2]]), variables = x))
+        self.assertRaises(ValueError, lambda: m.solve_batch(x.sum(), objectives = C, variables = x,
+                                                            rhs = B[:2], constraint = c))
+
+    def test41_solution_pool(self):
+        m = CPlexModel()
+
+        x = m.new(4, vtype = bool)
+        m.constrain(x.sum() <= 2)
+
+        n = m.populate(x.sum(), maximize = True, gap = 0, capacity = 10,
+                       replace = 'diversity', intensity = 4, limit = 100)
+
+        # All 6 ways of choosing 2 of 4
+        self.assertEqual(n, 6)
+        self.assertEqual(m.getPoolSize(), 6)
+        self.assert_((m.getPoolObjectives() == 2).all())
+
+        X = m.getPoolValues(x)
+        self.assertEqual(X.shape, (6, 4, 1))
+        self.assert_((X.sum(axis = 1) == 2).all())
+        self.assertEqual(len(set(tuple(X[k].ravel()) for k in range(6))), 6)
+
+        Y = m.getPoolValues(2*x)
+        self.assert_((Y == 2*X).all())
+
+        self.assertRaises(ValueError, lambda: m.populate(x.sum(), replace = 'bogus'))
+
+    def test42_lazy_constraints(self):
+        m = CPlexModel()
+
+        x = m.new(5, vtype = int, lb = 0, ub = 10)
+        c = (x <= 3)
+        m.constrain(x.sum() <= 12)
+        m.constrain(c, lazy = True)
+        m.constrain(x.sum() <= 20, user_cut = True)
+
+        self.assertEqual(m.getNumLazyConstraints(), 5)
+        self.assertEqual(m.getNumUserCuts(), 1)
+
+        self.assertAlmostEqual(m.maximize(x[0]), 3)
+        self.assert_((m[x] <= 3).all())
+
+        m.removeConstraint(c)
+        self.assertEqual(m.getNumLazyConstraints(), 0)
+        self.assertAlmostEqual(m.maximize(x[0]), 10)
+
+        self.assertRaises(ValueError, lambda: m.constrain(c, lazy = True, user_cut = True))
+
+    def test43_lazy_constraint_callback(self):
+        m = CPlexModel()
+
+        x = m.new(4, vtype = bool)
+        y = m.new(vtype = int, lb = 0, ub = 5)
+
+        calls = []
+
+        def separate(X, Y):
+            calls.append( (X.shape, Y.shape) )
+
+            cuts = []
+
+            if X.sum() > 2.5:
+                cuts.append(x.sum() <= 2)
+            if Y[0,0] > 3.5:
+                cuts.append(y <= 3)
+
+            return cuts
+
+        m.setLazyConstraintCallback(separate, x, y)
+
+        self.assertAlmostEqual(m.maximize(x.sum() + y), 5)
+        self.assert_(len(calls) > 0)
+        self.assertEqual(calls[0], ( (4, 1), (1, 1) ))
+
+        def fail(X):
+            raise KeyError("separation failed")
+
+        m.setLazyConstraintCallback(fail, x)
+        self.assertRaises(KeyError, lambda: m.maximize(x.sum() + y))
+
+        m.setLazyConstraintCallback(None)
+        self.assertAlmostEqual(m.maximize(x.sum() + y), 9)
+
+    def test44_solve_info(self):
+        m = CPlexModel()
+
+        x = m.new(3, lb = 0, ub = 2)
+        m.constrain(x.sum() <= 5)
+
+        self.assertEqual(m.getSolveInfo()['status'], 'none')
+
+        self.assertAlmostEqual(m.maximize(x.sum(), time_limit = 10), 5)
+
+        info = m.getSolveInfo()
+        self.assertEqual(info['status'], 'optimal')
+        self.assertAlmostEqual(info['objective'], 5)
+        self.assertAlmostEqual(info['best_bound'], 5)
+        self.assertAlmostEqual(info['gap'], 0)
+
+        # The limit only applies to that solve
+        self.assert_(m.getParameter("TiLim") > 10)
+
+        m.constrain(x.sum() >= 7)
+        self.assertRaises(CPlexNoSolution, lambda: m.maximize(x.sum()))
+        self.assertEqual(m.getSolveInfo()['status'], 'infeasible')
+
+        self.assertRaises(ValueError, lambda: m.maximize(x.sum(), time_limit = 0))
+
+    def test45_solve_info_mip_limit(self):
+        # A knapsack that can't be closed at the root with presolve and
+        # cuts off and no gap tolerance.  The empty MIP start gives an
+        # incumbent, so a node limit of one stops it with a solution.
+        n = 100
+        rn.seed(0)
+        w = rn.randint(1000, 2000, size = (1, n))
+        v = w + rn.uniform(0, 100, size = (1, n))
+
+        m = CPlexModel()
+        x = m.new(n, vtype = bool)
+        m.constrain(w*x <= w.sum() // 2 + 0.5)
+
+        m.setParameter("NodeLim", 1)
+        m.setParameter("PreInd", False)
+        m.setParameter("CutPass", -1)
+        m.setParameter("EpGap", 0.0)
+        m.setParameter("EpAGap", 0.0)
+
+        dettilim = m.getParameter("DetTiLim")
+        obj = m.maximize(v*x, mip_starts = [{x : zeros(n)}], det_time_limit = 1e6)
+
+        info = m.getSolveInfo()
+        self.assertEqual(info['status'], 'feasible')
+        self.assertAlmostEqual(info['objective'], obj)
+        self.assert_(info['best_bound'] > obj)
+        self.assert_(info['gap'] > 0)
+
+        self.assertEqual(m.getParameter("DetTiLim"), dettilim)
+
+    def test46_thread_budget(self):
+
+        setThreadBudget(2, threads_per_solve = 1)
+
+        try:
+            results = [None]*6
+            infos = [None]*6
+
+            def run(k):
+                m = CPlexModel()
+                x = m.new(10, lb = 0, ub = k + 1)
+                m.constrain(x.sum() <= k + 1)
+                if k == 0:
+                    m.setParameter("Threads", 4)
+                results[k] = m.maximize(x.sum())
+                infos[k] = m.getSolveInfo()
+
+            threads = [threading.Thread(target = run, args = (k,)) for k in range(6)]
+
+            for t in threads:
+                t.start()
+
+            for t in threads:
+                t.join()
+
+            for k in range(6):
+                self.assertAlmostEqual(results[k], k + 1)
+                self.assert_(1 <= infos[k]['threads'] <= 2)
+                self.assert_(infos[k]['queue_wait'] >= 0)
+
+            budget = getThreadBudget()
+            self.assertEqual(budget['threads'], 2)
+            self.assertEqual(budget['in_use'], 0)
+            self.assertEqual(budget['queued'], 0)
+            self.assert_(budget['solves'] >= 6)
+
+            # The Threads parameter is left as it was
+            m = CPlexModel()
+            x = m.new(lb = 0, ub = 1)
+            m.setParameter("Threads", 3)
+            m.maximize(x)
+            self.assertEqual(m.getParameter("Threads"), 3)
+            self.assertEqual(m.getSolveInfo()['threads'], 2)
+
+        finally:
+            setThreadBudget(None)
+
+        m = CPlexModel()
+        x = m.new(lb = 0, ub = 1)
+        m.maximize(x)
+        self.assertEqual(m.getSolveInfo()['threads'], 0)
+        self.assertEqual(getThreadBudget()['threads'], 0)
+
+    def test47_solve_scenarios(self):
+        rn.seed(0)
+        C = rn.rand(50, 4)
+        B = 1 + rn.randint(0, 3, size = (50, 1))
+
+        obj, X = solve_scenarios(_buildScenarioModel, objectives = C, rhs = B,
+                                 args = (4,), processes = 3, chunk_size = 7)
+
+        self.assertEqual(obj.shape, (50,))
+        self.assertEqual(X.shape, (50, 4))
+
+        # Same as solving them one after the other
+        m, options = _buildScenarioModel(4)
+        obj2, X2 = m.solve_batch(objectives = C, rhs = B, **options)
+
+        self.assert_(abs(obj - obj2).max() < 1e-6)
+        self.assert_(abs((X*C).sum(axis = 1) - obj).max() < 1e-6)
+
+        self.assertRaises(ValueError, lambda: solve_scenarios(_buildScenarioModel, args = (4,)))
+
+    def test48_constrain_many(self):
+        m = CPlexModel()
+
+        x = m.new(100, lb = 0)
+
+        m.constrain([x[i] <= i for i in range(50)],
+                    tuple([x[i] <= i] for i in range(50, 100)))
+
+        self.assertEqual(m.stats()['constraints_added'], 100)
+        self.assertAlmostEqual(m.maximize(x.sum()), sum(range(100)))
+
+        # A chained comparison adds both of its constraints
+        y = m.new()
+        m.constrain(1 <= y <= 2)
+        self.assertAlmostEqual(m.maximize(y), 2)
+        self.assertAlmostEqual(m.minimize(y), 1)
+
+        # Nothing is added if any of them is bad
+        n = m.stats()['constraints_added']
+        self.assertRaises(TypeError, lambda: m.constrain([x[0] <= 0, [x[1] <= 0, 'x']]))
+        self.assertEqual(m.stats()['constraints_added'], n)
+
+        m2 = CPlexModel()
+        z = m2.new()
+        self.assertRaises(CPlexException, lambda: m.constrain(x[0] <= 0, z <= 1))
+        self.assertEqual(m.stats()['constraints_added'], n)
+
+    def test49_constraint_batch(self):
+        m = CPlexModel()
+
+        x = m.new(100, lb = 0)
+        c = (x[0] <= 0.5)
+
+        with m.batch() as b:
+            for i in range(100):
+                m.constrain(x[i] <= i)
+
+            m.constrain(c)
+
+            # Not in the model until the batch ends
+            self.assertEqual(m.stats()['constraints_added'], 0)
+
+            m.removeConstraint(c)
+
+        self.assertEqual(b.rows, 102)
+        self.assertTrue(b.flush_time >= 0)
+        self.assertEqual(m.stats()['constraints_added'], 101)
+        self.assertAlmostEqual(m.maximize(x.sum()), sum(range(100)))
+
+        # Nested batches are flushed at the end of the outermost one
+        with m.batch() as b:
+            with m.batch() as b2:
+                m.constrain(x[99] <= 50)
+
+            self.assertEqual(b2.rows, 0)
+            self.assertAlmostEqual(m.maximize(x.sum()), sum(range(100)))
+
+        self.assertEqual(b.rows, 1)
+        self.assertAlmostEqual(m.maximize(x.sum()), sum(range(99)) + 50)
+
+        # Changes are dropped if the block raises
+        def failing():
+            with m.batch():
+                m.constrain(x[0] <= -1)
+                raise ValueError
+
+        self.assertRaises(ValueError, failing)
+        self.assertAlmostEqual(m.maximize(x.sum()), sum(range(99)) + 50)
+
+    def test50_clone_shared_bounds(self):
+        m = CPlexModel()
+        x = m.new(3, lb = 0, ub = 1)
+        c = (x.sum() <= 2)
+        m.constrain(c)
+
+        m2 = m.clone()
+        x2 = m2.translate(x)
+
+        # Both models hold the same variables and constraints
+        self.assertRaises(CPlexException, m2.update_bounds, x2, ub = 5)
+        self.assertRaises(CPlexException, m.update_bounds, x, ub = 5)
+        self.assertRaises(CPlexException, m.update_rhs, c, 3)
+
+        self.assertAlmostEqual(m.maximize(x.sum()), 2)
+        self.assertAlmostEqual(m2.maximize(x2.sum()), 2)
+        self.assert_((m[x] <= 1 + 1e-6).all())
+
+        # Once the clone is gone, bounds can be changed again
+        del m2, x2
+        gc.collect()
+
+        m.update_bounds(x, ub = 5)
+        m.update_rhs(c, 10)
+        self.assertAlmostEqual(m.maximize(x.sum()), 10)
+
+    @unittest.skipIf(not have_futures, "requires concurrent.futures")
+    def test51_build_during_lazy_solve(self):
+        m = CPlexModel()
+
+        x = m.new(4, vtype = bool)
+        y = m.new(4, vtype = bool)
+
+        started = threading.Event()
+
+        def separate(X):
+            started.set()
+
+            # Gives the main thread time to start building
+            time.sleep(0.2)
+
+            if X.sum() > 2.5:
+                return x.sum() <= 2
+
+        m.setLazyConstraintCallback(separate, x)
+
+        f = m.solve_async(x.sum(), maximize = True)
+        self.assert_(started.wait(60))
+
+        # Waits for the solve without holding up its callbacks
+        e = concatenate([x.sum() + 1, y.sum()])
+
+        self.assertAlmostEqual(f.result(timeout = 60), 2)
+        self.assertEqual(e.shape[0], 2)
+
+    def test52_solve_batch_lazy(self):
+        m = CPlexModel()
+
+        x = m.new(4, vtype = bool)
+
+        calls = []
+
+        def separate(X):
+            calls.append(X.sum())
+
+            if X.sum() > 2.5:
+                return x.sum() <= 2
+
+        m.setLazyConstraintCallback(separate, x)
+
+        obj, X = m.solve_batch(x.sum(), objectives = ar([[1, 1, 1, 1], [2, 1, 1, 1]]),
+                               variables = x, values = x, maximize = True)
+
+        # The lazy constraint holds in every scenario
+        self.assert_(len(calls) > 0)
+        self.assert_((X.sum(axis = 1) <= 2 + 1e-6).all())
+        self.assertAlmostEqual(obj[0], 2)
+        self.assertAlmostEqual(obj[1], 3)
+
+        def fail(X):
+            raise KeyError("separation failed")
+
+        m.setLazyConstraintCallback(fail, x)
+        self.assertRaises(KeyError, m.solve_batch, x.sum(),
+                          objectives = ar([[1, 1, 1, 1]]), variables = x)
+
+    def test53_read_unordered_names(self):
+        # Columns out of order, a matrix block in column-major order,
+        # and a block with a gap in its indices; each variable is held
+        # at its upper bound, which tells where it ended up.
+        mps = """NAME test
+ROWS
+ N obj
+ L c
+COLUMNS
+ x[1] obj -1 c 1
+ x[2] obj -1 c 1
+ x[0] obj -1 c 1
+ X[0,0] obj -1 c 1
+ X[1,0] obj -1 c 1
+ X[0,1] obj -1 c 1
+ X[1,1] obj -1 c 1
+ y[0] obj -1 c 1
+ y[2] obj -1 c 1
+RHS
+ rhs c 1000
+BOUNDS
+ UP bnd x[1] 2
+ UP bnd x[2] 3
+ UP bnd x[0] 1
+ UP bnd X[0,0] 1
+ UP bnd X[1,0] 11
+ UP bnd X[0,1] 2
+ UP bnd X[1,1] 12
+ UP bnd y[0] 5
+ UP bnd y[2] 7
+ENDATA
+"""
+
+        f, filename = tempfile.mkstemp(suffix = '.mps')
+        os.write(f, mps)
+        os.close(f)
+
+        try:
+            m, variables = CPlexModel.read(filename)
+        finally:
+            os.remove(filename)
+
+        m.solve(None)
+
+        x = variables['x']
+        X = variables['X']
+
+        self.assertEqual(x.shape, (3, 1))
+        self.assert_((m[x] == ar([1, 2, 3])).all())
+
+        self.assertEqual(X.shape, (2, 2))
+        self.assert_((m[X] == ar([[1, 2], [11, 12]])).all())
+
+        self.assert_('y' not in variables)
+        self.assertEqual(m[variables['y[0]']], 5)
+        self.assertEqual(m[variables['y[2]']], 7)
 
 if __name__ == '__main__':
     unittest.main()
-